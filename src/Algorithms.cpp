@@ -3,6 +3,9 @@
 #include "Math.hpp"
 #include "Random.hpp"
 #include <cassert>
+#include <map>
+#include <set>
+#include <algorithm>
 
 DeutschJozsaResult DeutschJozsa(const Bijection& oracle){
     // n is the number of bits that f takes as input.
@@ -10,11 +13,11 @@ DeutschJozsaResult DeutschJozsa(const Bijection& oracle){
 
     // Create a quantum register with n+1 qubits. Initalize the first n to 0 and the last to 1.
     QuantumRegister qr(n+1);
-    qr.applyUnitary(Unitary::X(), {n});
+    qr.applyUnitary(Gates::X, {n});
 
     // Apply a Hadamard transform to all qubits.
     for(int i = 0; i < n+1; i++){
-        qr.applyUnitary(Unitary::H(), {i});
+        qr.applyUnitary(Gates::H, {i});
     }
 
     // Apply the oracle
@@ -22,7 +25,7 @@ DeutschJozsaResult DeutschJozsa(const Bijection& oracle){
 
     // Apply a Hadamard transform on the first n qubits.
     for(int i = 0; i < n; i++){
-        qr.applyUnitary(Unitary::H(), {i});
+        qr.applyUnitary(Gates::H, {i});
     }
 
     // Measure the first n qubits.
@@ -37,23 +40,36 @@ DeutschJozsaResult DeutschJozsa(const Bijection& oracle){
     }
 }
 
+std::vector<DeutschJozsaResult> DeutschJozsa(const std::vector<Bijection>& oracles){
+    int n = integerLog2(oracles[0].size()) - 1;
+
+    // The same steps as DeutschJozsa above, applied to every instance of the batch, where instance b gets oracles[b].
+    BatchedRegister batch(n+1, oracles.size());
+    batch.applyUnitary(Gates::X, {n});
+    for(int i = 0; i < n+1; i++){
+        batch.applyUnitary(Gates::H, {i});
+    }
+    batch.applyBijections(oracles, QuantumRegister::inclusiveRange(0, n));
+    for(int i = 0; i < n; i++){
+        batch.applyUnitary(Gates::H, {i});
+    }
+
+    std::vector<DeutschJozsaResult> results;
+    for(BasisState output : batch.measure(QuantumRegister::inclusiveRange(0, n-1))){
+        results.push_back(output.toInteger() == 0 ? DeutschJozsaResult::CONSTANT : DeutschJozsaResult::BALANCED);
+    }
+    return results;
+}
+
 Bijection makeBitOracle(const std::vector<int>& f, int outputSize){
-    // Lambda to get the last n bits of integer a.
-    auto lastnBits = [](int a, int n){
-        return a & ~(~0 << n);
-    };
-
-    // The oracle needs to take |x>|y> to |x>|f(x) xor y>. We can do this by, for all numbers i = {x, y}, setting oracle[{x, y}] = {x, y ^ f(x)}
-    int N = f.size();
-    int oracleSize = N * (1 << outputSize);
-    std::vector<int> oracle(oracleSize);
-    for(int i = 0; i < oracleSize; i++){
-        int x = i >> outputSize;
-        int y = lastnBits(i, outputSize);
-        int output = (x << outputSize) | (y ^ f[x]);
-        oracle[i] = output;
-    }
-    return Bijection(oracle);
+    /*
+    The oracle needs to take |x>|y> to |x>|f(x) xor y>. For i = {x, y}, this is i xor f(x), since f(x) fits in the last outputSize bits.
+    The oracle computes this when it is applied, so it never needs a table of all 2^(n + outputSize) values.
+    */
+    StateIndex oracleSize = StateIndex(f.size()) << outputSize;
+    return Bijection(oracleSize, [f, outputSize](StateIndex i){
+        return i ^ f[i >> outputSize];
+    });
 }
 
 int Grover(const Rotation& oracle, int numAnswers){
@@ -69,7 +85,7 @@ int Grover(const Rotation& oracle, int numAnswers){
 
     // Apply a Hadamard transform to all qubits.
     for(int i = 0; i < n; i++){
-        qr.applyUnitary(Unitary::H(), {i});
+        qr.applyUnitary(Gates::H, {i});
     }
 
     std::vector<int> all = QuantumRegister::inclusiveRange(0, n-1);
@@ -78,9 +94,9 @@ int Grover(const Rotation& oracle, int numAnswers){
     Build the inside of the Grover diffusion operator by constructing the matrix 2|0^n><0^n| - I.
     Since this matrix has all zeros except for on the diagonal, we can represent it as a rotation.
     */
-    std::vector<std::complex<double>> rot(N, 1);
-    rot[0] = -1;
-    Rotation groverDiffusion(rot);
+    Rotation groverDiffusion(N, [](StateIndex x){
+        return std::complex<double>(x == 0 ? -1 : 1);
+    });
 
     // We need to run this loop for approximately PI/4 * sqrt(N/m) iterations, where m is the number of possible answers given by f.
     double ratio = (double)N / numAnswers;
@@ -94,7 +110,7 @@ int Grover(const Rotation& oracle, int numAnswers){
 
         // 1) First we apply a Hadamard transform to all qubits
         for(int i = 0; i < n; i++){
-            qr.applyUnitary(Unitary::H(), {i});
+            qr.applyUnitary(Gates::H, {i});
         }
 
         // 2) Next we apply the matrix 2|0^n><0^n| - I
@@ -102,7 +118,7 @@ int Grover(const Rotation& oracle, int numAnswers){
 
         // 3) Lastly we apply another Hadamard transform to all qubits
         for(int i = 0; i < n; i++){
-            qr.applyUnitary(Unitary::H(), {i});
+            qr.applyUnitary(Gates::H, {i});
         }
     }
 
@@ -111,140 +127,262 @@ int Grover(const Rotation& oracle, int numAnswers){
     return output.toInteger();
 }
 
-Rotation makePhaseOracle(const std::vector<bool>& f){
-    // Our oracle should be set to 1 if f(x) = 0, and -1 if f(x) = 1. 
-    int N = f.size();
-    std::vector<std::complex<double>> oracle(N, 1);
-    for(int i = 0; i < N; i++){
-        if(f[i]){
-            oracle[i] = -1;
+std::vector<int> Grover(const std::vector<Rotation>& oracles, int numAnswers){
+    int N = oracles[0].size();
+    int n = integerLog2(N);
+
+    // The same steps as Grover above, applied to every instance of the batch, where instance b gets oracles[b].
+    BatchedRegister batch(n, oracles.size());
+    for(int i = 0; i < n; i++){
+        batch.applyUnitary(Gates::H, {i});
+    }
+
+    std::vector<int> all = QuantumRegister::inclusiveRange(0, n-1);
+    Rotation groverDiffusion(N, [](StateIndex x){
+        return std::complex<double>(x == 0 ? -1 : 1);
+    });
+
+    int roundedIterations = (int)round((PI / 4) * sqrt((double)N / numAnswers));
+    for(int i = 0; i < roundedIterations; i++){
+        batch.applyRotations(oracles, all);
+        for(int i = 0; i < n; i++){
+            batch.applyUnitary(Gates::H, {i});
         }
+        batch.applyRotation(groverDiffusion, all);
+        for(int i = 0; i < n; i++){
+            batch.applyUnitary(Gates::H, {i});
+        }
+    }
+
+    std::vector<int> answers;
+    for(BasisState output : batch.measure(all)){
+        answers.push_back(output.toInteger());
     }
-    return Rotation(oracle);
+    return answers;
+}
+
+Rotation makePhaseOracle(const std::vector<bool>& f){
+    // Our oracle should be set to 1 if f(x) = 0, and -1 if f(x) = 1. This only keeps the bits of f, instead of a table of complex numbers.
+    return Rotation(f.size(), [f](StateIndex x){
+        return std::complex<double>(f[x] ? -1 : 1);
+    });
 }
 
-void QFT(QuantumRegister& qr, int start, int end){
+void QFT(QuantumRegister& qr, int start, int end, QFTMode mode, int approximationDegree){
+    if(mode == FFT){
+        qr.applyFourierTransform(start, end);
+        return;
+    }
+    makeQFTCircuit(start, end, approximationDegree).execute(qr);
+}
+
+void IQFT(QuantumRegister& qr, int start, int end, QFTMode mode, int approximationDegree){
+    if(mode == FFT){
+        qr.applyFourierTransform(start, end, true);
+        return;
+    }
+    makeIQFTCircuit(start, end, approximationDegree).execute(qr);
+}
+
+// Returns true if the approximate QFT of the given degree keeps the controlled rotation by 2 pi / 2^k.
+bool keepsRotation(int k, int approximationDegree){
+    return approximationDegree <= 0 || k <= approximationDegree;
+}
+
+Circuit makeQFTCircuit(int start, int end, int approximationDegree){
     /*
     This is the quantum Fourier transform circuit. It only requires the use of one- and two-qubit gates (Hadamard, controlled rotation, swap).
     A diagram of the cirucit can be found here:
         https://en.wikipedia.org/wiki/Quantum_Fourier_transform#Circuit_implementation
     */
+    Circuit circuit;
     for(int i = start; i <= end; i++){
-        qr.applyUnitary(Unitary::H(), {i});
-        for(int j = i+1; j <= end; j++){
+        circuit.addUnitary(Gates::H, {i});
+        for(int j = i+1; j <= end && keepsRotation(j - i + 1, approximationDegree); j++){
             int k = j - i + 1;
-            Unitary rk = Unitary::phase((2 * PI) / (1 << k));
-            qr.applyUnitary(rk.controlled(), {j, i});
+            circuit.addUnitary(Gates::controlledPhase((2 * PI) / (1 << k)), {j, i});
         }
     }
 
-    for(int i = start; i < end-i; i++){
-        qr.applyUnitary(Unitary::SWAP(), {i, end-i});
+    // Reverse the order of the wires.
+    for(int i = start, j = end; i < j; i++, j--){
+        circuit.addUnitary(Gates::SWAP, {i, j});
     }
+    return circuit;
 }
 
-void IQFT(QuantumRegister& qr, int start, int end){
+Circuit makeIQFTCircuit(int start, int end, int approximationDegree){
     /*
     The inverse of the QFT circuit.
     Apply all of the gates in reverse order, and reverse the directions of the phase gates.
     */
-    for(int i = start; i < end-i; i++){
-        qr.applyUnitary(Unitary::SWAP(), {i, end-i});
+    Circuit circuit;
+    for(int i = start, j = end; i < j; i++, j--){
+        circuit.addUnitary(Gates::SWAP, {i, j});
     }
 
     for(int i = end; i >= start; i--){
-        for(int j = i+1; j <= end; j++){
+        for(int j = i+1; j <= end && keepsRotation(j - i + 1, approximationDegree); j++){
             int k = j - i + 1;
-            Unitary rk = Unitary::phase((-2 * PI) / (1 << k));
-            qr.applyUnitary(rk.controlled(), {j, i});
+            circuit.addUnitary(Gates::controlledPhase((-2 * PI) / (1 << k)), {j, i});
         }
-        qr.applyUnitary(Unitary::H(), {i});
+        circuit.addUnitary(Gates::H, {i});
     }
+    return circuit;
 }
 
-Bijection makeShorUnitary(int a, int k, int N, int matrixSize){
-    // Build the unitary Ua^(2^k), which takes the state |x> to the state |a^(2^k) x (mod N)>, represented as a bijection.
-    std::vector<int> func(matrixSize);
-    for(int x = 0; x < matrixSize; x++){
-        func[x] = (integerPowerMod(a, 1LL << k, N) * x) % N;
+double approximateQFTFidelityLoss(int numQubits, int approximationDegree){
+    // There are numQubits - k + 1 rotations by 2 pi / 2^k, each at most 2 sin(pi / 2^k) away from the identity.
+    double eps = 0;
+    for(int k = 2; k <= numQubits; k++){
+        if(!keepsRotation(k, approximationDegree)){
+            eps += (numQubits - k + 1) * 2 * sin(PI / std::ldexp(1.0, k));
+        }
     }
-    return Bijection(func);
+    double overlap = std::max(0.0, 1 - eps * eps / 2);
+    return 1 - overlap * overlap;
+}
+
+/*
+The number of times Shor's algorithm measures the first q qubits of the final state. Each outcome gives a candidate for the period,
+and sampling them all from one simulation is much cheaper than simulating the circuit again for every candidate.
+*/
+const int SHOR_SHOTS = 16;
+
+// The closed-form probability of output y of the inverse QFT of a comb (see Algorithms.hpp for the formula).
+double combIQFTProbability(StateIndex y, StateIndex spacing, StateIndex count, int q){
+    assert(q <= 31);
+    StateIndex Q = StateIndex(1) << q;
+
+    // sin^2 has period pi, so both angles can be reduced modulo Q first, which keeps them exact.
+    StateIndex t = (spacing * y) & (Q - 1);
+    if(t == 0){
+        return (double)count / Q;
+    }
+    double numerator = std::sin(PI * ((count * t) & (Q - 1)) / Q);
+    double denominator = std::sin(PI * t / Q);
+    return (numerator * numerator) / (denominator * denominator * count * Q);
+}
+
+/*
+Looks for a comb in the first q qubits of a register whose other n qubits have all been measured: equal coefficients on the values
+start, start + spacing, ..., start + (count - 1) spacing. Returns false if the register holds anything else.
+*/
+bool findComb(const QuantumRegister& qr, int n, StateIndex& start, StateIndex& spacing, StateIndex& count){
+    std::vector<AmplitudeMap::Entry> states = qr.getStates();
+    if(states.empty()){
+        return false;
+    }
+    start = states[0].first >> n;
+    spacing = states.size() > 1 ? (states[1].first >> n) - start : 1;
+    count = states.size();
+    for(StateIndex k = 0; k < count; k++){
+        if((states[k].first >> n) != start + k * spacing || std::abs(states[k].second - states[0].second) > 1e-9){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Samples shots outputs of the inverse QFT of a comb on q qubits, without applying it. We add up the probability of every output in increasing order,
+and hand out the shots by sorted random numbers along the way, so this is two passes over the 2^q outputs (computing a sine each) and no state at all.
+*/
+std::map<StateIndex, int> sampleCombIQFT(StateIndex spacing, StateIndex count, int q, int shots){
+    StateIndex Q = StateIndex(1) << q;
+    double total = 0;
+    for(StateIndex y = 0; y < Q; y++){
+        total += combIQFTProbability(y, spacing, count, q);
+    }
+
+    std::vector<double> draws(shots);
+    for(double& draw : draws){
+        draw = generateRandomDouble() * total;
+    }
+    std::sort(draws.begin(), draws.end());
+
+    std::map<StateIndex, int> outputs;
+    double sum = 0;
+    int next = 0;
+    for(StateIndex y = 0; y < Q && next < shots; y++){
+        sum += combIQFTProbability(y, spacing, count, q);
+        while(next < shots && (draws[next] < sum || y == Q - 1)){
+            outputs[y]++;
+            next++;
+        }
+    }
+    return outputs;
 }
 
 /*
 With high probability, given the values of N and a, this algorithm finds the period of the function f(x) = a^x (mod N).
 That is, the smallest r > 0 such that a^r = 1 (mod N).
+The circuit is simulated once, and the first q qubits are then measured shots times, giving how many times each output came up.
 */
-BasisState ShorQuantumSubroutine(int N, int a, int q, int n, bool log){
-    // Initialize the quantum register with q+n qubits. We also need to set the last qubit to 1.
+std::map<StateIndex, int> ShorQuantumSubroutine(int N, int a, int q, int n, int shots, bool log, ShorMode mode, int approximationDegree){
+    if(log) std::cout << "Running the modular exponentiation..." << std::endl;
+
+    // The quantum register has q+n qubits. We need to set the last qubit to 1.
     QuantumRegister qr(q+n);
-    qr.applyUnitary(Unitary::X(), {q+n-1});
+    qr.applyUnitary(Gates::X, {q+n-1});
 
     // Apply a Hadamard transform to the first q qubits.
-    if(log) std::cout << "Applying Hadamards..." << std::endl;
     for(int i = 0; i < q; i++){
-        qr.applyUnitary(Unitary::H(), {i});
+        qr.applyUnitary(Gates::H, {i});
     }
 
-    if(log) std::cout << "Applying unitaries..." << std::endl;
-    for(int i = 0; i < q; i++){      
-        // We need to apply a controlled Ua^(2^k) gate to the last n qubits. Our control qubit starts at q-1 and goes to 0 as we run through the loop.
-        std::vector<int> qubitsToApply;
-        qubitsToApply.push_back(q-1-i);
-        for(int j = q; j < q+n; j++){
-            qubitsToApply.push_back(j);
-        }
-
-        // Apply the unitary Ua^(2^k) which takes |x> to |a^(2^k) x (mod N)> .
-        Bijection ua2k = makeShorUnitary(a, i, N, 1 << n);
-        qr.applyBijection(ua2k.controlled(), qubitsToApply);
+    /*
+    We need to apply a controlled Ua^(2^i) gate to the last n qubits, which takes |x> to |a^(2^i) x (mod N)>. Our control qubit starts at q-1 and goes to 0
+    as we run through the loop. Each multiplier is the square of the one before, so it only takes one multiplication to get the next one.
+    */
+    std::vector<int> work = QuantumRegister::inclusiveRange(q, q+n-1);
+    long long multiplier = a % N;
+    for(int i = 0; i < q; i++){
+        qr.applyModularMultiplication(multiplier, N, {q-1-i}, work);
+        multiplier = (multiplier * multiplier) % N;
     }
 
     // Measure the last n qubits to reduce the state of the quantum system before we do a QFT. The output doesn't matter.
-    qr.measure(QuantumRegister::inclusiveRange(q, q+n-1));
-
-    // Now we need to apply an inverse QFT on the first q qubits.
-    if(log) std::cout << "Applying inverse QFT..." << std::endl;
-    IQFT(qr, 0, q-1);
+    qr.measure(work);
 
-    // Now we measure the first q qubits.
-    BasisState output = qr.measure(QuantumRegister::inclusiveRange(0, q-1));
-    return output;
-}
-
-ShorResult Shor(int N, bool log){
-    // Keep trying random values of a until we find the factors.
-    while(true){
-        int a = generateRandomInt(2, N-1);
-        std::optional<ShorResult> ans = Shor(N, a, log);
-        if(ans.has_value()){
-            return ans.value();
+    StateIndex start, spacing, count;
+    if(mode == STRUCTURED){
+        if(findComb(qr, n, start, spacing, count)){
+            if(log) std::cout << "The first register holds a comb of " << count << " value(s), so the inverse QFT is sampled in closed form." << std::endl;
+            return sampleCombIQFT(spacing, count, q, shots);
         }
+        if(log) std::cout << "The first register does not hold a comb, so the inverse QFT is computed with an FFT." << std::endl;
+        IQFT(qr, 0, q-1, FFT);
     }
-}
-
-std::optional<ShorResult> Shor(int N, int a, bool log){
-    if(log) std::cout << "Running Shor's algorithm with N = " << N << " and a = " << a << std::endl;
-    // If a happens to share a factor with N, then we are done and don't need to run the quantum portion of the algorithm.
-    int K = gcd(a, N);
-    if(K != 1){
-        // The factors of N are K and N/K. However, since we want to test the quantum portion, we ignore the result.
-        if(log) std::cout << "We found an answer, but using classical methods." << std::endl;
-        return {};
+    else{
+        // Now we need to apply an inverse QFT on the first q qubits (or an approximate one, which loses at most the given fidelity).
+        Circuit iqft = makeIQFTCircuit(0, q-1, approximationDegree);
+        if(log) std::cout << "Running the inverse QFT circuit (" << iqft.size() << " operations)..." << std::endl;
+        if(log && approximationDegree > 0){
+            std::cout << "The approximate inverse QFT of degree " << approximationDegree << " loses a fidelity of at most "
+                << approximateQFTFidelityLoss(q, approximationDegree) << "." << std::endl;
+        }
+        iqft.execute(qr);
     }
 
-    // Find q, the number of qubits for the first portion of the register.
-    int q = 0;
-    while((1 << q) < N*N){
-        q++;
-    }
+    /*
+    Now we measure the first q qubits. The work register was already measured above, so every shot comes from the same collapsed state,
+    but whatever its outcome was, the peaks of the distribution are at the same multiples of 2^q / r.
+    */
+    std::map<StateIndex, int> outputs = qr.sample(QuantumRegister::inclusiveRange(0, q-1), shots);
 
-    // Find n, the number of qubits for the second portion of the register.
-    int n = integerLog2(N) + 1; 
+    if(log){
+        const RepresentationStats& stats = qr.getStats();
+        std::cout << "The register converted " << stats.sparseToDenseConversions << " time(s) to dense and " << stats.denseToSparseConversions
+            << " time(s) to sparse, taking " << stats.conversionSeconds << " seconds." << std::endl;
+    }
+    return outputs;
+}
 
-    BasisState output = ShorQuantumSubroutine(N, a, q, n, log);
-    
-    int y = output.toInteger();
+/*
+Given an output y of the quantum subroutine, uses continued fractions to guess the period r, and tries to find the factors of N with it.
+*/
+std::optional<ShorResult> ShorFromOutput(int N, int a, int y, int q, bool log){
     int Q = 1 << q;
     std::vector<int> expansion = continuedFractionExpansion(y, Q);
 
@@ -287,8 +425,152 @@ std::optional<ShorResult> Shor(int N, int a, bool log){
         if(log) std::cout << "r = " << r_test << " gave us the correct factors." << std::endl;
         return ShorResult{factor1, factor2};
     }
+    return {};
+}
+
+/*
+Tries the outputs sampled from the quantum subroutine for the guess a, and returns the factors of N if one of them finds them.
+*/
+std::optional<ShorResult> ShorFromOutputs(int N, int a, const std::map<StateIndex, int>& outputs, int q, bool log){
+    // Try the outputs that came up most often first.
+    std::vector<std::pair<int, StateIndex>> candidates;
+    for(const auto& output : outputs){
+        candidates.push_back({output.second, output.first});
+    }
+    std::sort(candidates.rbegin(), candidates.rend());
+    if(log) std::cout << "Sampled " << candidates.size() << " different output(s) from the final state." << std::endl;
+
+    for(const auto& candidate : candidates){
+        std::optional<ShorResult> result = ShorFromOutput(N, a, candidate.second, q, log);
+        if(result.has_value()){
+            return result;
+        }
+    }
     
     // If none of those r values worked, return SHOR_INVALID as we couldn't find an answer.
     if(log) std::cout << "Didn't find an answer." << std::endl;
     return {};
+}
+
+ShorResult Shor(int N, bool log, ShorMode mode, int approximationDegree){
+    /*
+    Keep trying random values of a until we find the factors. Every candidate one value of a gives us is tried from a single simulation,
+    so we don't simulate the same a again unless every value has already been tried.
+    */
+    std::set<int> triedBases;
+    while(true){
+        int a = generateRandomInt(2, N-1);
+        if(triedBases.count(a) && (int)triedBases.size() < N-2){
+            continue;
+        }
+        triedBases.insert(a);
+        std::optional<ShorResult> ans = Shor(N, a, log, mode, approximationDegree);
+        if(ans.has_value()){
+            return ans.value();
+        }
+    }
+}
+
+std::optional<ShorResult> Shor(int N, int a, bool log, ShorMode mode, int approximationDegree){
+    if(log) std::cout << "Running Shor's algorithm with N = " << N << " and a = " << a << std::endl;
+    // If a happens to share a factor with N, then we are done and don't need to run the quantum portion of the algorithm.
+    int K = gcd(a, N);
+    if(K != 1){
+        // The factors of N are K and N/K. However, since we want to test the quantum portion, we ignore the result.
+        if(log) std::cout << "We found an answer, but using classical methods." << std::endl;
+        return {};
+    }
+
+    // Find q, the number of qubits for the first portion of the register.
+    int q = 0;
+    while((1 << q) < N*N){
+        q++;
+    }
+
+    // Find n, the number of qubits for the second portion of the register.
+    int n = integerLog2(N) + 1; 
+
+    std::map<StateIndex, int> outputs = ShorQuantumSubroutine(N, a, q, n, SHOR_SHOTS, log, mode, approximationDegree);
+    return ShorFromOutputs(N, a, outputs, q, log);
+}
+
+std::vector<std::optional<ShorResult>> Shor(int N, const std::vector<int>& bases, bool log){
+    std::vector<std::optional<ShorResult>> results(bases.size());
+
+    // Only the guesses that do not share a factor with N are simulated, as in Shor(N, a). instances[k] is the guess that instance k runs.
+    std::vector<int> instances;
+    for(int k = 0; k < (int)bases.size(); k++){
+        if(gcd(bases[k], N) != 1){
+            if(log) std::cout << "a = " << bases[k] << " shares a factor with N, so it is not simulated." << std::endl;
+            continue;
+        }
+        instances.push_back(k);
+    }
+    if(instances.empty()){
+        return results;
+    }
+
+    int q = 0;
+    while((1 << q) < N*N){
+        q++;
+    }
+    int n = integerLog2(N) + 1;
+
+    if(log) std::cout << "Running the modular exponentiation for " << instances.size() << " value(s) of a at once..." << std::endl;
+
+    // The same steps as ShorQuantumSubroutine in GATE_LEVEL mode, where instance k multiplies by powers of its own guess.
+    BatchedRegister batch(q+n, instances.size());
+    batch.applyUnitary(Gates::X, {q+n-1});
+    for(int i = 0; i < q; i++){
+        batch.applyUnitary(Gates::H, {i});
+    }
+
+    std::vector<int> work = QuantumRegister::inclusiveRange(q, q+n-1);
+    std::vector<StateIndex> multipliers;
+    for(int k : instances){
+        multipliers.push_back(bases[k] % N);
+    }
+    for(int i = 0; i < q; i++){
+        batch.applyModularMultiplication(multipliers, N, {q-1-i}, work);
+        for(StateIndex& multiplier : multipliers){
+            multiplier = (multiplier * multiplier) % N;
+        }
+    }
+
+    // Each instance measures its own work register, and then one inverse QFT circuit runs on every instance.
+    batch.measure(work);
+    Circuit iqft = makeIQFTCircuit(0, q-1);
+    if(log) std::cout << "Running the inverse QFT circuit (" << iqft.size() << " operations)..." << std::endl;
+    iqft.execute(batch.getRegister());
+
+    std::vector<std::map<StateIndex, int>> outputs = batch.sample(QuantumRegister::inclusiveRange(0, q-1), SHOR_SHOTS);
+    for(int k = 0; k < (int)instances.size(); k++){
+        int a = bases[instances[k]];
+        if(log) std::cout << "Trying the outputs for a = " << a << std::endl;
+        results[instances[k]] = ShorFromOutputs(N, a, outputs[k], q, log);
+    }
+    return results;
+}
+
+ShorResult ShorBatched(int N, int batchSize, bool log){
+    // As in Shor(N), keep trying random values of a (that were not tried before) until one of them gives the factors, but batchSize of them at a time.
+    std::set<int> triedBases;
+    while(true){
+        std::vector<int> bases;
+        while((int)bases.size() < batchSize && (int)triedBases.size() < N-2){
+            int a = generateRandomInt(2, N-1);
+            if(triedBases.insert(a).second){
+                bases.push_back(a);
+            }
+        }
+        if(bases.empty()){
+            triedBases.clear();
+            continue;
+        }
+        for(const std::optional<ShorResult>& ans : Shor(N, bases, log)){
+            if(ans.has_value()){
+                return ans.value();
+            }
+        }
+    }
 }
\ No newline at end of file
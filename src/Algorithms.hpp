@@ -4,6 +4,8 @@
 #include "Unitary.hpp"
 #include "Function.hpp"
 #include "QuantumRegister.hpp"
+#include "BatchedRegister.hpp"
+#include "Circuit.hpp"
 #include <optional>
 
 /*
@@ -27,6 +29,12 @@ This oracle can be generated from a valid function f using the makeBitOracle fun
 */
 DeutschJozsaResult DeutschJozsa(const Bijection& oracle);
 
+/*
+Runs the Deutsch-Jozsa algorithm on every oracle at once in a BatchedRegister (the oracles must all have the same size), and returns the result for each.
+This gives the same answers as calling DeutschJozsa on each oracle, but every gate is applied to the whole batch in one pass.
+*/
+std::vector<DeutschJozsaResult> DeutschJozsa(const std::vector<Bijection>& oracles);
+
 /*
 Constructs a bit oracle given a valid function f for use in the Deutsch-Jozsa algorithm.
 The oracle is returned in the form of a bijection of size 2^n, where oracle(|x>|y>) = |x>|y xor f(x)>.
@@ -52,6 +60,12 @@ There is also a more complicated version of Grover's algorithm that works withou
 */
 int Grover(const Rotation& oracle, int numAnswers);
 
+/*
+Runs Grover's algorithm on every oracle at once in a BatchedRegister (the oracles must all have the same size and the same number of answers),
+and returns the answer found for each.
+*/
+std::vector<int> Grover(const std::vector<Rotation>& oracles, int numAnswers);
+
 /*
 Constructs a phase oracle given a valid function f with range = {0, 1} for use in Grover's algorithm.
 The oracle is returned in the form of a rotation function of size 2^n, where oracle(|x>) = (-1)^f(x) |x>.
@@ -59,19 +73,50 @@ This function assumes that f is given as a boolean vector of size 2^n for some p
 */
 Rotation makePhaseOracle(const std::vector<bool>& f);
 
+/*
+How QFT and IQFT (defined below) transform a register.
+GATES runs the circuit of one- and two-qubit gates (see makeQFTCircuit), the way a quantum computer would.
+FFT computes the same transform with a fast Fourier transform on the amplitudes (see QuantumRegister::applyFourierTransform),
+which takes O(m 2^n) time on m of the n qubits of a dense register instead of O(m^2 2^n).
+*/
+enum QFTMode {
+    GATES, FFT
+};
+
 /*
 Computes the quantum Fourier transform (QFT) of a section of a quantum register.
 The QFT takes the quantum state |j> to the state 1/sqrt(N) sum(k=0 to N-1) exp(2 pi i j k / N).
-This implementation constructs the QFT using only one- and two-qubit gates.
+By default, this implementation constructs the QFT using only one- and two-qubit gates.
+With the GATES mode, a non-zero approximationDegree gives the approximate QFT (see makeQFTCircuit). The FFT is always exact.
 */
-void QFT(QuantumRegister& qr, int start, int end);
+void QFT(QuantumRegister& qr, int start, int end, QFTMode mode = GATES, int approximationDegree = 0);
 
 /*
 Computes the inverse quantum Fourier transform (IQFT) of a section of a quantum register.
 The IQFT takes the quantum state |j> to the state 1/sqrt(N) sum(k=0 to N-1) exp(-2 pi i j k / N).
-This implementation constructs the QFT using only one- and two-qubit gates.
+By default, this implementation constructs the QFT using only one- and two-qubit gates.
+With the GATES mode, a non-zero approximationDegree gives the approximate IQFT (see makeQFTCircuit). The FFT is always exact.
+*/
+void IQFT(QuantumRegister& qr, int start, int end, QFTMode mode = GATES, int approximationDegree = 0);
+
+/*
+Builds the circuits used by QFT and IQFT on the wires start to end (both sides inclusive).
+Building the circuit once and running it with Circuit::execute avoids rebuilding every gate when the same transform is needed many times.
+
+The exact circuit on m wires has m (m - 1) / 2 controlled rotations by 2 pi / 2^k, for k = 2 to m. Those with a large k barely change the state,
+but each one still costs a pass over it. With an approximationDegree d > 0, only the rotations with k <= d are kept (the approximate QFT),
+which leaves fewer than m d of them, so d = O(log m) brings the circuit down to O(m log m) gates. An approximationDegree of 0 keeps every rotation.
+*/
+Circuit makeQFTCircuit(int start, int end, int approximationDegree = 0);
+Circuit makeIQFTCircuit(int start, int end, int approximationDegree = 0);
+
+/*
+Returns an upper bound on the fidelity lost by the approximate QFT (or IQFT) on numQubits wires, that is, on 1 - |<psi|phi>|^2 where psi is
+the output of the exact transform and phi the output of the approximate one, for any input state. Each dropped rotation by theta differs from
+the identity by at most |1 - exp(i theta)| = 2 sin(theta / 2), so the two outputs are at most eps apart, where eps adds this up over every dropped
+rotation, and their overlap is at least 1 - eps^2 / 2. The bound is 0 for the exact transform.
 */
-void IQFT(QuantumRegister& qr, int start, int end);
+double approximateQFTFidelityLoss(int numQubits, int approximationDegree);
 
 /*
 Return type for Shor's algorithm (defined below)
@@ -81,6 +126,17 @@ struct ShorResult {
     int factor2;
 };
 
+/*
+How Shor's algorithm simulates its quantum subroutine.
+GATE_LEVEL applies every gate, including the O(q^2) gates of the inverse QFT on the first register.
+STRUCTURED applies the gates up to the measurement of the work register. At that point the first register always holds an equal superposition
+of values spaced r apart (a comb), and the outcome distribution of the inverse QFT of a comb has a closed form (see combIQFTProbability),
+so the outputs are sampled from it directly. If the register does not hold a comb, it falls back to the inverse QFT, computed with an FFT (see QFTMode).
+*/
+enum ShorMode {
+    GATE_LEVEL, STRUCTURED
+};
+
 /*
 Given an integer N that is the product of two primes, calculate its factors.
 Shor's algorithm works by picking a random number a less than N, finding the period of the function f(x) = a^x mod N,
@@ -89,13 +145,35 @@ On real quantum hardware, Shor's algorithm runs in polynomial time.
 
 Since this function can take a while (we may need to run the quantum subroutine multiple times and quantum simulation takes exponential time on classical hardware),
 there is also an option to log progress updates.
+In GATE_LEVEL mode, a non-zero approximationDegree replaces the inverse QFT with the approximate one (see makeQFTCircuit), which needs fewer gates.
+The peaks of the output distribution stay where they are, and the log reports the bound on the fidelity lost (see approximateQFTFidelityLoss).
+*/
+ShorResult Shor(int N, bool log = false, ShorMode mode = GATE_LEVEL, int approximationDegree = 0);
+
+/*
+This is verion of Shor's algorithm where the guess a is given. This function runs the quantum subroutine once, samples several outputs from its final state,
+and tries each of them as a candidate for the period. It returns the factors of N if it finds them, and otherwise returns SHOR_INVALID.
+*/
+std::optional<ShorResult> Shor(int N, int a, bool log = false, ShorMode mode = GATE_LEVEL, int approximationDegree = 0);
+
+/*
+Runs the quantum subroutine of Shor's algorithm (at the gate level) for every guess in bases at once, in one BatchedRegister where instance k multiplies
+by powers of bases[k], and returns what Shor(N, bases[k], log) would return for each. The inverse QFT and the sampling are done once for the whole batch.
+Guesses that share a factor with N are not simulated (as in Shor(N, a)). The register needs log2 of the number of guesses more qubits than a single run.
+*/
+std::vector<std::optional<ShorResult>> Shor(int N, const std::vector<int>& bases, bool log = false);
+
+/*
+Shor's algorithm with the random guesses tried batchSize at a time (with the batched Shor above), until one of them gives the factors of N.
 */
-ShorResult Shor(int N, bool log = false);
+ShorResult ShorBatched(int N, int batchSize, bool log = false);
 
 /*
-This is verion of Shor's algorithm where the guess a is given. This function runs the quantum subroutine once, returns the factors of N if it finds them,
-and otherwise returns SHOR_INVALID.
+Returns the probability of measuring y after applying the inverse QFT to q qubits holding an equal superposition of count values spaced spacing apart.
+This does not depend on the first value of the comb (which only changes the phases), and is
+    sin^2(pi count spacing y / 2^q) / (count 2^q sin^2(pi spacing y / 2^q)),
+or count / 2^q when spacing y is a multiple of 2^q.
 */
-std::optional<ShorResult> Shor(int N, int a, bool log = false);
+double combIQFTProbability(StateIndex y, StateIndex spacing, StateIndex count, int q);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,50 @@
+#ifndef ALIGNED_ALLOCATOR_HPP
+#define ALIGNED_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <complex>
+
+/*
+An allocator that aligns every allocation to a cache line boundary.
+Amplitude buffers use this so that vectorized loops never straddle cache lines.
+*/
+template <typename T, std::size_t Alignment = 64>
+class AlignedAllocator{
+    public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind{
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(std::size_t n){
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* p, std::size_t){
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const {
+        return false;
+    }
+};
+
+// A contiguous, cache line aligned array of amplitudes.
+using AmplitudeVector = std::vector<std::complex<double>, AlignedAllocator<std::complex<double>>>;
+
+#endif
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include "AmplitudeMap.hpp"
+#include <algorithm>
+#include <utility>
+
+// The map starts with this many slots, and grows once it is more than MAX_LOAD_NUMERATOR / MAX_LOAD_DENOMINATOR full.
+const std::size_t MIN_SLOTS = 16;
+const std::size_t MAX_LOAD_NUMERATOR = 4;
+const std::size_t MAX_LOAD_DENOMINATOR = 5;
+
+// shrinkToFit only shrinks a map that is less than 1 / SHRINK_FACTOR as full as it could be, so that a map that shrinks a little and grows back is not rehashed every time.
+const std::size_t SHRINK_FACTOR = 8;
+
+// The largest distance an entry can be from its slot, since distances are stored in a byte. The map grows if an entry would go further.
+const unsigned MAX_DISTANCE = 255;
+
+AmplitudeMap::AmplitudeMap(){
+    rehash(MIN_SLOTS);
+}
+
+void AmplitudeMap::rehash(std::size_t minCapacity){
+    std::size_t capacity = MIN_SLOTS;
+    while(capacity < minCapacity){
+        capacity *= 2;
+    }
+
+    std::vector<Entry> oldEntries(capacity);
+    std::vector<std::uint8_t> oldDistances(capacity, 0);
+    oldEntries.swap(entries);
+    oldDistances.swap(distances);
+    numEntries = 0;
+    shift = 64;
+    for(std::size_t slots = capacity; slots > 1; slots /= 2){
+        shift--;
+    }
+
+    for(std::size_t slot = 0; slot < oldDistances.size(); slot++){
+        if(oldDistances[slot] != 0){
+            insertNew(oldEntries[slot].first, oldEntries[slot].second);
+        }
+    }
+}
+
+std::size_t AmplitudeMap::insertNew(StateIndex state, std::complex<double> coeff){
+    if(MAX_LOAD_DENOMINATOR * (numEntries + 1) > MAX_LOAD_NUMERATOR * distances.size()){
+        rehash(2 * distances.size());
+    }
+
+    std::size_t mask = distances.size() - 1;
+    std::size_t slot = homeSlot(state);
+    std::size_t insertedSlot = distances.size();
+    Entry entry{state, coeff};
+    unsigned distance = 1;
+    while(distances[slot] != 0){
+        if(distances[slot] < distance){
+            // The entry here is closer to its slot than ours, so ours takes its place and we carry on inserting the displaced entry.
+            std::swap(entry, entries[slot]);
+            unsigned displacedDistance = distances[slot];
+            distances[slot] = distance;
+            distance = displacedDistance;
+            if(insertedSlot == distances.size()){
+                insertedSlot = slot;
+            }
+        }
+        slot = (slot + 1) & mask;
+        distance++;
+
+        if(distance > MAX_DISTANCE){
+            // Very unlikely with a good hash, but the distance would no longer fit in a byte. Grow the map and insert the entry we are carrying there.
+            rehash(2 * distances.size());
+            insertNew(entry.first, entry.second);
+            return findSlot(state);
+        }
+    }
+    entries[slot] = entry;
+    distances[slot] = distance;
+    numEntries++;
+    return insertedSlot == distances.size() ? slot : insertedSlot;
+}
+
+void AmplitudeMap::clear(){
+    std::fill(distances.begin(), distances.end(), 0);
+    numEntries = 0;
+}
+
+void AmplitudeMap::reserve(std::size_t n){
+    std::size_t needed = MAX_LOAD_DENOMINATOR * n / MAX_LOAD_NUMERATOR + 1;
+    if(needed > distances.size()){
+        rehash(needed);
+    }
+}
+
+bool AmplitudeMap::shrinkToFit(){
+    std::size_t needed = MAX_LOAD_DENOMINATOR * numEntries / MAX_LOAD_NUMERATOR + 1;
+    if(distances.size() <= MIN_SLOTS || SHRINK_FACTOR * needed > distances.size()){
+        return false;
+    }
+    rehash(needed);
+    return true;
+}
+
+void AmplitudeMap::swap(AmplitudeMap& other){
+    entries.swap(other.entries);
+    distances.swap(other.distances);
+    std::swap(numEntries, other.numEntries);
+    std::swap(shift, other.shift);
+}
+
+bool AmplitudeMap::erase(StateIndex state){
+    std::size_t slot = findSlot(state);
+    if(slot == distances.size()){
+        return false;
+    }
+
+    // Shift the entries after this one back by a slot, until we reach an empty slot or an entry that is already in its own slot.
+    std::size_t mask = distances.size() - 1;
+    std::size_t next = (slot + 1) & mask;
+    while(distances[next] > 1){
+        entries[slot] = entries[next];
+        distances[slot] = distances[next] - 1;
+        slot = next;
+        next = (next + 1) & mask;
+    }
+    distances[slot] = 0;
+    numEntries--;
+    return true;
+}
\ No newline at end of file
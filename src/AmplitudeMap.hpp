@@ -0,0 +1,178 @@
+#ifndef AMPLITUDE_MAP_HPP
+#define AMPLITUDE_MAP_HPP
+
+#include "BasisState.hpp"
+#include <vector>
+#include <complex>
+#include <cstdint>
+#include <cstddef>
+
+/*
+A hash map from basis states to coefficients, used by sparse registers.
+Unlike std::unordered_map, which allocates a node for every state, all of the entries are stored in one contiguous array (open addressing),
+so looking up or inserting a state never allocates, and clearing the map keeps its memory for the next gate.
+
+Collisions are resolved with robin hood hashing: each entry remembers how far it is from the slot its state hashes to, and an insertion
+takes the place of any entry that is closer to its own slot. This keeps every entry close to its slot even when the map is nearly full,
+and lets a lookup stop as soon as it reaches an entry closer to its slot than the state being looked up would be.
+*/
+class AmplitudeMap{
+    public:
+    // The layout matches std::pair so that entry.first and entry.second work as they do with std::unordered_map.
+    struct Entry{
+        StateIndex first;
+        std::complex<double> second;
+    };
+
+    private:
+    std::vector<Entry> entries;
+
+    // distances[slot] is 0 if the slot is empty, and otherwise 1 + how far the entry is from the slot its state hashes to.
+    std::vector<std::uint8_t> distances;
+
+    std::size_t numEntries = 0;
+    int shift = 64;
+
+    std::size_t homeSlot(StateIndex state) const {
+        // Mix the bits of the state (states often differ only in a few high bits), then keep the top bits as the slot.
+        StateIndex hash = state * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+        hash *= 0xBF58476D1CE4E5B9ULL;
+        return hash >> shift;
+    }
+
+    // Sets the number of slots to the smallest power of 2 that is at least minCapacity (and MIN_SLOTS), and reinserts every entry.
+    void rehash(std::size_t minCapacity);
+
+    public:
+    template <typename EntryType, typename MapType>
+    class Iterator{
+        private:
+        MapType* map;
+        std::size_t slot;
+
+        void skipEmpty(){
+            while(slot < map->distances.size() && map->distances[slot] == 0){
+                slot++;
+            }
+        }
+
+        public:
+        Iterator(MapType* _map, std::size_t _slot): map(_map), slot(_slot) {
+            skipEmpty();
+        }
+        EntryType& operator*() const {
+            return map->entries[slot];
+        }
+        EntryType* operator->() const {
+            return &map->entries[slot];
+        }
+        Iterator& operator++(){
+            slot++;
+            skipEmpty();
+            return *this;
+        }
+        bool operator==(const Iterator& other) const {
+            return slot == other.slot;
+        }
+        bool operator!=(const Iterator& other) const {
+            return slot != other.slot;
+        }
+    };
+    using iterator = Iterator<Entry, AmplitudeMap>;
+    using const_iterator = Iterator<const Entry, const AmplitudeMap>;
+
+    AmplitudeMap();
+
+    std::size_t size() const {
+        return numEntries;
+    }
+    bool empty() const {
+        return numEntries == 0;
+    }
+
+    // Removes every entry, but keeps the memory so that the map can be refilled without allocating.
+    void clear();
+
+    // Makes room for n entries, so that inserting them does not need to rehash.
+    void reserve(std::size_t n);
+
+    /*
+    Iterating over the map goes through every slot, so after most of the entries are gone (e.g. after a measurement) the map costs as much as it did at its largest.
+    This rehashes to fewer slots when the map is far emptier than its slots, and returns true if it did.
+    */
+    bool shrinkToFit();
+
+    // Exchanges the contents (and memory) of two maps.
+    void swap(AmplitudeMap& other);
+
+    // Returns the slot holding a state, or numSlots() if the state is not in the map.
+    std::size_t findSlot(StateIndex state) const {
+        std::size_t mask = distances.size() - 1;
+        std::size_t slot = homeSlot(state);
+        for(unsigned distance = 1; distances[slot] >= distance; distance++){
+            if(entries[slot].first == state){
+                return slot;
+            }
+            slot = (slot + 1) & mask;
+        }
+        return distances.size();
+    }
+
+    // Returns a pointer to the coefficient of a state, or nullptr if the state is not in the map.
+    std::complex<double>* find(StateIndex state){
+        std::size_t slot = findSlot(state);
+        return slot == distances.size() ? nullptr : &entries[slot].second;
+    }
+    const std::complex<double>* find(StateIndex state) const {
+        std::size_t slot = findSlot(state);
+        return slot == distances.size() ? nullptr : &entries[slot].second;
+    }
+
+    // Returns the coefficient of a state, inserting the state with a coefficient of 0 if it is not in the map yet.
+    std::complex<double>& operator[](StateIndex state){
+        std::complex<double>* coeff = find(state);
+        if(coeff){
+            return *coeff;
+        }
+        return entries[insertNew(state, 0)].second;
+    }
+
+    /*
+    Inserts a state that must not be in the map yet, and returns the slot it ends up in.
+    This skips the lookup that operator[] does first, for callers that already know every state they insert is different.
+    */
+    std::size_t insertNew(StateIndex state, std::complex<double> coeff);
+
+    // Removes a state from the map. Returns false if it was not there.
+    bool erase(StateIndex state);
+
+    /*
+    The entries are stored in numSlots() slots, some of which are empty. This lets the slots be split between threads:
+    different slots always hold different states, so their coefficients can be updated at the same time.
+    */
+    std::size_t numSlots() const {
+        return distances.size();
+    }
+    bool isOccupied(std::size_t slot) const {
+        return distances[slot] != 0;
+    }
+    Entry& entryAt(std::size_t slot){
+        return entries[slot];
+    }
+
+    iterator begin(){
+        return iterator(this, 0);
+    }
+    iterator end(){
+        return iterator(this, distances.size());
+    }
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+    const_iterator end() const {
+        return const_iterator(this, distances.size());
+    }
+};
+
+#endif
\ No newline at end of file
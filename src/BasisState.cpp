@@ -1,7 +1,9 @@
 #include "BasisState.hpp"
 #include <cassert>
 
-BasisState::BasisState(int _qubitStates, int _numQubits): qubitStates(_qubitStates), numQubits(_numQubits) {}
+BasisState::BasisState(StateIndex _qubitStates, int _numQubits): qubitStates(_qubitStates), numQubits(_numQubits) {
+    assert(numQubits <= 64);
+}
     
 bool BasisState::getQubit(int qubit) const {
     assert(qubit >= 0 && qubit < numQubits);
@@ -15,19 +17,20 @@ void BasisState::setQubit(int qubit, bool value){
 
     int qubitReverse = numQubits - 1 - qubit;
     if(value){
-        qubitStates |= (1 << qubitReverse);
+        qubitStates |= (StateIndex(1) << qubitReverse);
     }
     else{
-        qubitStates &= ~(1 << qubitReverse);
+        qubitStates &= ~(StateIndex(1) << qubitReverse);
     }
 }
 
-int BasisState::toInteger(){
+StateIndex BasisState::toInteger(){
     return qubitStates;
 }
 
 void BasisState::addQubit(bool value){
     numQubits++;
+    assert(numQubits <= 64);
     qubitStates <<= 1;
     if(value){
         qubitStates |= 1;
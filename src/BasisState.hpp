@@ -3,6 +3,13 @@
 
 #include <string>
 #include <ostream>
+#include <cstdint>
+
+/*
+The index of a basis state, where bit n - 1 - q holds the value of qubit q. This is 64 bits wide so that sparse registers (which only store
+the occupied states) can have up to 64 qubits, e.g. for GHZ states or the reversible arithmetic in Shor's algorithm.
+*/
+using StateIndex = std::uint64_t;
 
 /*
 This class represents a basis vector for an n-dimensional quantum state.
@@ -10,17 +17,17 @@ We can represent an arbitrary n qubit quantum state as a superposition of basis
 */
 class BasisState{
     private:
-    int qubitStates;
+    StateIndex qubitStates;
     int numQubits;
 
     public:
-    BasisState(int _qubitStates, int _numQubits);
+    BasisState(StateIndex _qubitStates, int _numQubits);
 
     // Note: for get and set qubit, we use the convention that qubit 0 is the qubit that comes first (i.e the MOST signifigant bit). This makes circuit design easier.
     bool getQubit(int qubit) const;
     void setQubit(int qubit, bool value);
 
-    int toInteger();
+    StateIndex toInteger();
 
     // Add an extra qubit to the end of the basis state.
     void addQubit(bool value);
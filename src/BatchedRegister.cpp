@@ -0,0 +1,178 @@
+#include "BatchedRegister.hpp"
+#include <cassert>
+#include <cmath>
+#include <unordered_map>
+
+int batchQubitsFor(int batchSize){
+    int batchQubits = 0;
+    while((1 << batchQubits) < batchSize){
+        batchQubits++;
+    }
+    return batchQubits;
+}
+
+/*
+Builds the register for the batch, with every instance at state 0. The batch wires hold an equal superposition of the instances 0 to batchSize - 1 only,
+so when batchSize is not a power of 2 the values of the batch wires past the last instance are never used.
+*/
+QuantumRegister makeBatchRegister(int numQubits, int batchSize){
+    assert(numQubits > 0 && batchSize > 0);
+    int batchQubits = batchQubitsFor(batchSize);
+    std::unordered_map<StateIndex, std::complex<double>> superposition;
+    for(int b = 0; b < batchSize; b++){
+        superposition[b] = 1 / sqrt(batchSize);
+    }
+    return QuantumRegister(numQubits + batchQubits, superposition);
+}
+
+BatchedRegister::BatchedRegister(int _numQubits, int _batchSize): numQubits(_numQubits), batchSize(_batchSize), batchQubits(batchQubitsFor(_batchSize)),
+                                                                  qr(makeBatchRegister(_numQubits, _batchSize)) {
+    batchWires = QuantumRegister::inclusiveRange(numQubits, numQubits + batchQubits - 1);
+}
+
+BatchedRegister::BatchedRegister(int _numQubits, int _batchSize, Representation representation): BatchedRegister(_numQubits, _batchSize) {
+    AdaptivePolicy policy = qr.getAdaptivePolicy();
+    policy.enabled = false;
+    qr.setAdaptivePolicy(policy);
+    qr.setRepresentation(representation);
+}
+
+std::vector<int> BatchedRegister::withBatchWires(const std::vector<int>& qubits) const {
+    for(int i : qubits){
+        // The batch wires belong to the batch, not to an instance.
+        assert(0 <= i && i < numQubits);
+    }
+    std::vector<int> wires = qubits;
+    wires.insert(wires.end(), batchWires.begin(), batchWires.end());
+    return wires;
+}
+
+int BatchedRegister::getNumQubits() const {
+    return numQubits;
+}
+
+int BatchedRegister::getBatchSize() const {
+    return batchSize;
+}
+
+QuantumRegister& BatchedRegister::getRegister(){
+    return qr;
+}
+
+void BatchedRegister::applyUnitary(const Unitary& u, const std::vector<int>& qubitsToApply){
+    qr.applyUnitary(u, qubitsToApply);
+}
+
+void BatchedRegister::applyUnitary(const FixedUnitary<1>& u, const std::vector<int>& qubitsToApply){
+    qr.applyUnitary(u, qubitsToApply);
+}
+
+void BatchedRegister::applyUnitary(const FixedUnitary<2>& u, const std::vector<int>& qubitsToApply){
+    qr.applyUnitary(u, qubitsToApply);
+}
+
+void BatchedRegister::applyUnitary(const Unitary& u, const std::vector<int>& controls, const std::vector<int>& qubitsToApply){
+    qr.applyUnitary(u, controls, qubitsToApply);
+}
+
+void BatchedRegister::applyBijection(const Bijection& f, const std::vector<int>& qubitsToApply){
+    qr.applyBijection(f, qubitsToApply);
+}
+
+void BatchedRegister::applyRotation(const Rotation& f, const std::vector<int>& qubitsToApply){
+    qr.applyRotation(f, qubitsToApply);
+}
+
+void BatchedRegister::applyFourierTransform(int start, int end, bool inverse){
+    assert(end < numQubits);
+    qr.applyFourierTransform(start, end, inverse);
+}
+
+/*
+The functions of every instance are combined into one function of the qubits and the batch wires, which applies fs[b] to the value of the qubits
+when the batch wires hold b. Values of the batch wires past the last instance hold no amplitude, and are left alone.
+*/
+void BatchedRegister::applyBijections(const std::vector<Bijection>& fs, const std::vector<int>& qubitsToApply){
+    assert((int)fs.size() == batchSize);
+    StateIndex size = fs[0].size();
+    for(const Bijection& f : fs){
+        assert(f.size() == size && size == (StateIndex(1) << qubitsToApply.size()));
+    }
+    int shift = batchQubits;
+    StateIndex mask = (StateIndex(1) << shift) - 1;
+    StateIndex numInstances = batchSize;
+    qr.applyBijection(Bijection(size << shift, [&fs, shift, mask, numInstances](StateIndex x){
+        StateIndex b = x & mask;
+        return b < numInstances ? (fs[b].apply(x >> shift) << shift) | b : x;
+    }), withBatchWires(qubitsToApply));
+}
+
+void BatchedRegister::applyRotations(const std::vector<Rotation>& fs, const std::vector<int>& qubitsToApply){
+    assert((int)fs.size() == batchSize);
+    StateIndex size = fs[0].size();
+    for(const Rotation& f : fs){
+        assert(f.size() == size && size == (StateIndex(1) << qubitsToApply.size()));
+    }
+    int shift = batchQubits;
+    StateIndex mask = (StateIndex(1) << shift) - 1;
+    StateIndex numInstances = batchSize;
+    qr.applyRotation(Rotation(size << shift, [&fs, shift, mask, numInstances](StateIndex x){
+        StateIndex b = x & mask;
+        return b < numInstances ? fs[b].getRotation(x >> shift) : std::complex<double>(1);
+    }), withBatchWires(qubitsToApply));
+}
+
+void BatchedRegister::applyModularMultiplication(const std::vector<StateIndex>& multipliers, StateIndex modulus, const std::vector<int>& controls,
+                                                 const std::vector<int>& qubitsToApply){
+    assert((int)multipliers.size() == batchSize);
+    int m = qubitsToApply.size();
+    assert(modulus > 0 && modulus <= (StateIndex(1) << m));
+
+    // As in QuantumRegister::applyModularMultiplication, the values from modulus up are left alone, and a large modulus takes the product in 128 bits.
+    std::vector<StateIndex> reduced;
+    for(StateIndex multiplier : multipliers){
+        reduced.push_back(multiplier % modulus);
+    }
+    bool wide = modulus > (StateIndex(1) << 32);
+    int shift = batchQubits;
+    StateIndex mask = (StateIndex(1) << shift) - 1;
+    qr.applyBijection(Bijection(StateIndex(1) << (m + shift), [&reduced, modulus, wide, shift, mask](StateIndex x){
+        StateIndex b = x & mask;
+        StateIndex value = x >> shift;
+        if(b >= reduced.size() || value >= modulus){
+            return x;
+        }
+        StateIndex product = wide ? (StateIndex)((unsigned __int128)reduced[b] * value % modulus) : reduced[b] * value % modulus;
+        return (product << shift) | b;
+    }), controls, withBatchWires(qubitsToApply));
+}
+
+std::complex<double> BatchedRegister::getCoefficient(int instance, StateIndex state) const {
+    assert(0 <= instance && instance < batchSize);
+    // Each instance only holds 1 / batchSize of the probability of the register.
+    return qr.getCoefficient((state << batchQubits) | instance) * sqrt(batchSize);
+}
+
+double BatchedRegister::probability(int instance, StateIndex state) const {
+    return std::norm(getCoefficient(instance, state));
+}
+
+std::vector<BasisState> BatchedRegister::measure(const std::vector<int>& qubitsToMeasure){
+    for(int i : qubitsToMeasure){
+        // Measuring a batch wire would pick an instance, instead of measuring every instance.
+        assert(0 <= i && i < numQubits);
+    }
+    std::vector<BasisState> outcomes = qr.measureEach(qubitsToMeasure, batchWires);
+    // The values of the batch wires past the last instance hold no amplitude, so their outcomes mean nothing.
+    outcomes.erase(outcomes.begin() + batchSize, outcomes.end());
+    return outcomes;
+}
+
+std::vector<std::map<StateIndex, int>> BatchedRegister::sample(const std::vector<int>& qubitsToSample, int shots){
+    for(int i : qubitsToSample){
+        assert(0 <= i && i < numQubits);
+    }
+    std::vector<std::map<StateIndex, int>> histograms = qr.sampleEach(qubitsToSample, batchWires, shots);
+    histograms.erase(histograms.begin() + batchSize, histograms.end());
+    return histograms;
+}
\ No newline at end of file
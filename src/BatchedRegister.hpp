@@ -0,0 +1,81 @@
+#ifndef BATCHED_REGISTER_HPP
+#define BATCHED_REGISTER_HPP
+
+#include "Unitary.hpp"
+#include "FixedUnitary.hpp"
+#include "Function.hpp"
+#include "BasisState.hpp"
+#include "QuantumRegister.hpp"
+#include <vector>
+#include <map>
+#include <complex>
+
+/*
+Runs batchSize independent registers of numQubits qubits each (the instances) as one register, so that a gate is applied to every instance in one pass.
+
+The instances are stored in a single QuantumRegister with batchQubits = ceil(log2(batchSize)) extra wires after the numQubits wires of an instance.
+These batch wires hold the index of the instance in an equal superposition, so state x of instance b is the state (x << batchQubits) | b of the register.
+Since the batch wires are the lowest bits of the state, the amplitudes of every instance for the same x sit next to each other, and a gate on the wires
+of an instance acts on runs batchSize times longer than it would on a single instance. This way every gate path of QuantumRegister (the vectorized
+kernels, the thread pool, the sparse and dense representations and the switches between them) handles the whole batch at once, with no per-gate overhead
+for each instance. Gates never touch the batch wires, so the instances never interfere with each other.
+
+Gates shared by every instance are applied as usual (also through getRegister, e.g. to run a Circuit on the wires 0 to numQubits - 1), while
+applyBijections and applyRotations give each instance its own oracle, and measure and sample give each instance its own outcome.
+*/
+class BatchedRegister{
+    private:
+    int numQubits;
+    int batchSize;
+    int batchQubits;
+    QuantumRegister qr;
+
+    // The wires numQubits to numQubits + batchQubits - 1, which hold the index of the instance.
+    std::vector<int> batchWires;
+
+    // Returns qubits followed by the batch wires, so that a function of them sees the value of the qubits shifted up by batchQubits, plus the instance.
+    std::vector<int> withBatchWires(const std::vector<int>& qubits) const;
+
+    public:
+    BatchedRegister(int _numQubits, int _batchSize);
+
+    // Starts the register in the given representation and turns off the adaptive policy (as QuantumRegister(qubits, representation) does).
+    BatchedRegister(int _numQubits, int _batchSize, Representation representation);
+
+    int getNumQubits() const;
+    int getBatchSize() const;
+
+    // The register holding every instance. Its wires 0 to numQubits - 1 are the wires of the instances, and gates applied to them act on every instance.
+    QuantumRegister& getRegister();
+
+    // Gates shared by every instance.
+    void applyUnitary(const Unitary& u, const std::vector<int>& qubitsToApply);
+    void applyUnitary(const FixedUnitary<1>& u, const std::vector<int>& qubitsToApply);
+    void applyUnitary(const FixedUnitary<2>& u, const std::vector<int>& qubitsToApply);
+    void applyUnitary(const Unitary& u, const std::vector<int>& controls, const std::vector<int>& qubitsToApply);
+    void applyBijection(const Bijection& f, const std::vector<int>& qubitsToApply);
+    void applyRotation(const Rotation& f, const std::vector<int>& qubitsToApply);
+    void applyFourierTransform(int start, int end, bool inverse = false);
+
+    /*
+    Applies fs[b] to the given qubits of instance b, for every instance (e.g. a different oracle per instance). There must be one function per instance,
+    all of the same size. Each is called only for the values its instance actually holds, so together they cost one pass over the register.
+    */
+    void applyBijections(const std::vector<Bijection>& fs, const std::vector<int>& qubitsToApply);
+    void applyRotations(const std::vector<Rotation>& fs, const std::vector<int>& qubitsToApply);
+
+    // Applies QuantumRegister::applyModularMultiplication to instance b with multipliers[b], for every instance.
+    void applyModularMultiplication(const std::vector<StateIndex>& multipliers, StateIndex modulus, const std::vector<int>& controls, const std::vector<int>& qubitsToApply);
+
+    // The coefficient of a state (of numQubits qubits) in the given instance, as it would be in a register of its own.
+    std::complex<double> getCoefficient(int instance, StateIndex state) const;
+    double probability(int instance, StateIndex state) const;
+
+    // Measures the given qubits of every instance, and returns the outcome of each instance (see QuantumRegister::measureEach).
+    std::vector<BasisState> measure(const std::vector<int>& qubitsToMeasure);
+
+    // Samples the given qubits of every instance shots times without collapsing the register, and returns the histogram of each instance (see QuantumRegister::sampleEach).
+    std::vector<std::map<StateIndex, int>> sample(const std::vector<int>& qubitsToSample, int shots);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,387 @@
+#include "Circuit.hpp"
+#include <cassert>
+#include <algorithm>
+
+Circuit::Circuit() {}
+
+void Circuit::addOperation(OperationType type, int gateIndex, const std::vector<int>& qubits, const std::vector<int>& controls, StateIndex controlValues){
+    operations.push_back(Operation{type, gateIndex, (int)qubitList.size(), (int)qubits.size(), (int)controls.size(), controlValues});
+    qubitList.insert(qubitList.end(), qubits.begin(), qubits.end());
+    qubitList.insert(qubitList.end(), controls.begin(), controls.end());
+}
+
+void Circuit::addUnitary(const Unitary& u, const std::vector<int>& qubits){
+    assert((1 << qubits.size()) == u.size());
+
+    unitaries.push_back(u);
+    addOperation(UNITARY, unitaries.size() - 1, qubits);
+}
+
+void Circuit::addBijection(const Bijection& f, const std::vector<int>& qubits){
+    assert((StateIndex(1) << qubits.size()) == f.size());
+
+    bijections.push_back(f);
+    addOperation(BIJECTION, bijections.size() - 1, qubits);
+}
+
+void Circuit::addRotation(const Rotation& f, const std::vector<int>& qubits){
+    assert((StateIndex(1) << qubits.size()) == f.size());
+
+    rotations.push_back(f);
+    addOperation(ROTATION, rotations.size() - 1, qubits);
+}
+
+void Circuit::addMeasurement(const std::vector<int>& qubits){
+    addOperation(MEASUREMENT, -1, qubits);
+}
+
+void Circuit::addUnitary(const Unitary& u, const std::vector<int>& controls, const std::vector<int>& qubits, StateIndex controlValues){
+    assert((1 << qubits.size()) == u.size());
+
+    unitaries.push_back(u);
+    addOperation(UNITARY, unitaries.size() - 1, qubits, controls, controlValues);
+}
+
+void Circuit::addBijection(const Bijection& f, const std::vector<int>& controls, const std::vector<int>& qubits, StateIndex controlValues){
+    assert((StateIndex(1) << qubits.size()) == f.size());
+
+    bijections.push_back(f);
+    addOperation(BIJECTION, bijections.size() - 1, qubits, controls, controlValues);
+}
+
+void Circuit::addRotation(const Rotation& f, const std::vector<int>& controls, const std::vector<int>& qubits, StateIndex controlValues){
+    assert((StateIndex(1) << qubits.size()) == f.size());
+
+    rotations.push_back(f);
+    addOperation(ROTATION, rotations.size() - 1, qubits, controls, controlValues);
+}
+
+void Circuit::append(const Circuit& circuit){
+    for(const Operation& operation : circuit.operations){
+        std::vector<int> qubits = circuit.getQubits(operation);
+        std::vector<int> controls = circuit.getControls(operation);
+        switch(operation.type){
+            case UNITARY:
+                addUnitary(circuit.getUnitary(operation), controls, qubits, operation.controlValues);
+                break;
+            case BIJECTION:
+                addBijection(circuit.getBijection(operation), controls, qubits, operation.controlValues);
+                break;
+            case ROTATION:
+                addRotation(circuit.getRotation(operation), controls, qubits, operation.controlValues);
+                break;
+            case MEASUREMENT:
+                addMeasurement(qubits);
+                break;
+        }
+    }
+}
+
+int Circuit::size() const {
+    return operations.size();
+}
+
+const std::vector<Circuit::Operation>& Circuit::getOperations() const {
+    return operations;
+}
+
+std::vector<int> Circuit::getQubits(const Operation& operation) const {
+    auto start = qubitList.begin() + operation.qubitStart;
+    return std::vector<int>(start, start + operation.qubitCount);
+}
+
+std::vector<int> Circuit::getControls(const Operation& operation) const {
+    auto start = qubitList.begin() + operation.qubitStart + operation.qubitCount;
+    return std::vector<int>(start, start + operation.controlCount);
+}
+
+const Unitary& Circuit::getUnitary(const Operation& operation) const {
+    assert(operation.type == UNITARY);
+    return unitaries[operation.gateIndex];
+}
+
+const Bijection& Circuit::getBijection(const Operation& operation) const {
+    assert(operation.type == BIJECTION);
+    return bijections[operation.gateIndex];
+}
+
+const Rotation& Circuit::getRotation(const Operation& operation) const {
+    assert(operation.type == ROTATION);
+    return rotations[operation.gateIndex];
+}
+
+/*
+Given a unitary u acting on the wires in qubits, returns the same unitary acting on the wires in allQubits (which must contain qubits).
+We tensor u with the identity on the extra wires, and then reorder the rows and columns to the order of allQubits.
+*/
+Unitary expandUnitary(const Unitary& u, const std::vector<int>& qubits, const std::vector<int>& allQubits){
+    int m = qubits.size();
+    int w = allQubits.size();
+    if(qubits == allQubits){
+        return u;
+    }
+
+    // The order of the wires after tensoring: first the wires of u, then the rest.
+    std::vector<int> tensorOrder = qubits;
+    for(int qubit : allQubits){
+        if(std::find(qubits.begin(), qubits.end(), qubit) == qubits.end()){
+            tensorOrder.push_back(qubit);
+        }
+    }
+    Unitary tensored = u.tensor(Unitary::identity(1 << (w - m)));
+
+    // reordered[b] is the state (in the order of allQubits) that gives every wire the same value as state b (in tensorOrder).
+    int size = 1 << w;
+    std::vector<int> reordered(size, 0);
+    for(int k = 0; k < w; k++){
+        int position = std::find(allQubits.begin(), allQubits.end(), tensorOrder[k]) - allQubits.begin();
+        for(int b = 0; b < size; b++){
+            if((b >> (w - 1 - k)) & 1){
+                reordered[b] |= 1 << (w - 1 - position);
+            }
+        }
+    }
+
+    // Entry (b, c) of the tensored unitary moves to (reordered[b], reordered[c]), which is p * tensored * p^T for the permutation matrix p, in one copy.
+    AmplitudeVector entries((size_t)size * size);
+    for(int b = 0; b < size; b++){
+        const std::complex<double>* row = tensored[b];
+        std::complex<double>* target = &entries[(size_t)reordered[b] * size];
+        for(int c = 0; c < size; c++){
+            target[reordered[c]] = row[c];
+        }
+    }
+    return Unitary(size, std::move(entries));
+}
+
+Circuit Circuit::fused(int maxWidth) const {
+    Circuit circuit;
+
+    // The unitary we are currently building up, and the wires it acts on.
+    std::vector<int> blockQubits;
+    Unitary block = Unitary::identity(1);
+
+    auto flush = [&](){
+        if(!blockQubits.empty()){
+            circuit.addUnitary(block, blockQubits);
+            blockQubits.clear();
+        }
+    };
+
+    for(const Operation& operation : operations){
+        std::vector<int> qubits = getQubits(operation);
+        if(operation.type != UNITARY || operation.controlCount > 0){
+            flush();
+            std::vector<int> controls = getControls(operation);
+            switch(operation.type){
+                case UNITARY:
+                    circuit.addUnitary(getUnitary(operation), controls, qubits, operation.controlValues);
+                    break;
+                case BIJECTION:
+                    circuit.addBijection(getBijection(operation), controls, qubits, operation.controlValues);
+                    break;
+                case ROTATION:
+                    circuit.addRotation(getRotation(operation), controls, qubits, operation.controlValues);
+                    break;
+                default:
+                    circuit.addMeasurement(qubits);
+                    break;
+            }
+            continue;
+        }
+
+        std::vector<int> combinedQubits = blockQubits;
+        for(int qubit : qubits){
+            if(std::find(blockQubits.begin(), blockQubits.end(), qubit) == blockQubits.end()){
+                combinedQubits.push_back(qubit);
+            }
+        }
+
+        const Unitary& u = getUnitary(operation);
+        if(blockQubits.empty() || (int)combinedQubits.size() > maxWidth){
+            // Start a new block with this gate.
+            flush();
+            blockQubits = qubits;
+            block = u;
+        }
+        else{
+            // The gate comes after the block, so it multiplies the block from the left.
+            block = expandUnitary(u, qubits, combinedQubits) * expandUnitary(block, blockQubits, combinedQubits);
+            blockQubits = combinedQubits;
+        }
+    }
+    flush();
+
+    return circuit;
+}
+
+/*
+The number of upcoming operations Circuit::execute looks at when deciding which qubits to swap into the low bits of the state index.
+*/
+const int BLOCKING_LOOKAHEAD = 256;
+
+std::vector<BasisState> Circuit::execute(QuantumRegister& qr, int blockQubits) const {
+    int n = qr.getNumQubits();
+    bool blocking = blockQubits > 0 && n > blockQubits;
+
+    /*
+    Qubit q of the circuit is currently held by wire layout[q] of the register, and wire w holds qubit contents[w].
+    Wires are only ever exchanged in pairs with their original position, so layout is its own inverse and one call to swapQubits restores it.
+    */
+    std::vector<int> layout(n), contents(n);
+    for(int q = 0; q < n; q++){
+        layout[q] = contents[q] = q;
+    }
+    auto toWires = [&](const std::vector<int>& qubits){
+        std::vector<int> wires;
+        for(int qubit : qubits){
+            wires.push_back(layout[qubit]);
+        }
+        return wires;
+    };
+    // A wire is local if it is stored in one of the lowest blockQubits bits of the state index.
+    auto isLocal = [&](int wire){
+        return n - 1 - wire < blockQubits;
+    };
+    auto allLocal = [&](const std::vector<int>& wires){
+        return std::all_of(wires.begin(), wires.end(), isLocal);
+    };
+    auto swapWires = [&](const std::vector<std::pair<int, int>>& pairs){
+        qr.swapQubits(pairs);
+        for(const auto& pair : pairs){
+            std::swap(contents[pair.first], contents[pair.second]);
+            layout[contents[pair.first]] = pair.first;
+            layout[contents[pair.second]] = pair.second;
+        }
+    };
+
+    /*
+    Swaps the qubits used by the unitaries starting at operations[start] into local wires, if it is worth it.
+    We evict the local qubits whose next use is furthest away, and only ever swap a qubit with the one at its original wire.
+    Bringing in qubit q in place of qubit v saves one pass over the state for every use of q before v is needed again.
+    */
+    auto localize = [&](int start){
+        std::vector<std::vector<int>> window;
+        for(int i = start; i < (int)operations.size() && i < start + BLOCKING_LOOKAHEAD && operations[i].type == UNITARY && operations[i].controlCount == 0; i++){
+            window.push_back(getQubits(operations[i]));
+        }
+        const int NEVER = window.size();
+        std::vector<int> firstUse(n, NEVER);
+        for(int i = NEVER - 1; i >= 0; i--){
+            for(int qubit : window[i]){
+                firstUse[qubit] = i;
+            }
+        }
+        auto usesBefore = [&](int qubit, int end){
+            int uses = 0;
+            for(int i = 0; i < end; i++){
+                uses += std::count(window[i].begin(), window[i].end(), qubit);
+            }
+            return uses;
+        };
+
+        std::vector<int> wanted, victims;
+        for(int q = 0; q < n; q++){
+            if(firstUse[q] != NEVER && !isLocal(layout[q])){
+                wanted.push_back(q);
+            }
+            if(isLocal(layout[q]) && layout[q] == q){
+                victims.push_back(q);
+            }
+        }
+        std::sort(wanted.begin(), wanted.end(), [&](int a, int b){ return firstUse[a] < firstUse[b]; });
+        std::sort(victims.begin(), victims.end(), [&](int a, int b){ return firstUse[a] > firstUse[b]; });
+
+        std::vector<std::pair<int, int>> pairs;
+        int savedPasses = 0;
+        int nextVictim = 0;
+        for(int q : wanted){
+            // If q was moved out of its local wire earlier, it goes back there (and the qubit that took its place goes back as well).
+            bool displaced = layout[q] != q;
+            if(!displaced && nextVictim == (int)victims.size()){
+                continue;
+            }
+            int victim = displaced ? contents[q] : victims[nextVictim];
+            if(firstUse[victim] <= firstUse[q]){
+                continue;
+            }
+            pairs.push_back({q, displaced ? layout[q] : victim});
+            savedPasses += usesBefore(q, firstUse[victim]);
+            if(!displaced){
+                nextVictim++;
+            }
+        }
+
+        // The swap is a pass over the state, and so is swapping back at the end.
+        if(savedPasses > 2){
+            swapWires(pairs);
+        }
+    };
+
+    std::vector<const Unitary*> groupGates;
+    std::vector<std::vector<int>> groupWires;
+    auto flush = [&](){
+        if(groupGates.size() > 1 && qr.getRepresentation() == DENSE){
+            qr.applyUnitariesBlocked(groupGates, groupWires, blockQubits);
+        }
+        else{
+            for(int g = 0; g < (int)groupGates.size(); g++){
+                qr.applyUnitary(*groupGates[g], groupWires[g]);
+            }
+        }
+        groupGates.clear();
+        groupWires.clear();
+    };
+
+    std::vector<BasisState> measurements;
+    for(int i = 0; i < (int)operations.size(); i++){
+        const Operation& operation = operations[i];
+        if(operation.type == UNITARY && operation.controlCount == 0 && blocking && qr.getRepresentation() == DENSE){
+            if(!allLocal(toWires(getQubits(operation)))){
+                flush();
+                localize(i);
+            }
+            std::vector<int> wires = toWires(getQubits(operation));
+            if(allLocal(wires)){
+                groupGates.push_back(&unitaries[operation.gateIndex]);
+                groupWires.push_back(wires);
+            }
+            else{
+                qr.applyUnitary(unitaries[operation.gateIndex], wires);
+            }
+            continue;
+        }
+
+        flush();
+        std::vector<int> wires = toWires(getQubits(operation));
+        std::vector<int> controlWires = toWires(getControls(operation));
+        switch(operation.type){
+            case UNITARY:
+                qr.applyUnitary(unitaries[operation.gateIndex], controlWires, wires, operation.controlValues);
+                break;
+            case BIJECTION:
+                qr.applyBijection(bijections[operation.gateIndex], controlWires, wires, operation.controlValues);
+                break;
+            case ROTATION:
+                qr.applyRotation(rotations[operation.gateIndex], controlWires, wires, operation.controlValues);
+                break;
+            case MEASUREMENT:
+                measurements.push_back(qr.measure(wires));
+                break;
+        }
+    }
+    flush();
+
+    // Put every qubit back on its own wire.
+    std::vector<std::pair<int, int>> pairs;
+    for(int q = 0; q < n; q++){
+        if(q < layout[q]){
+            pairs.push_back({q, layout[q]});
+        }
+    }
+    if(!pairs.empty()){
+        qr.swapQubits(pairs);
+    }
+
+    return measurements;
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+#ifndef CIRCUIT_HPP
+#define CIRCUIT_HPP
+
+#include "Unitary.hpp"
+#include "FixedUnitary.hpp"
+#include "Function.hpp"
+#include "BasisState.hpp"
+#include "QuantumRegister.hpp"
+#include <vector>
+
+/*
+Represents a quantum circuit, that is, a recorded list of operations (unitaries, bijections, rotations and measurements) on the wires of a quantum register.
+Instead of applying each gate to a register right away, we first record the gates in a circuit and then run the whole circuit on a register with execute.
+This way a circuit only has to be built once, and can then be run on as many registers as we want (e.g. once per shot).
+*/
+class Circuit{
+    public:
+    enum OperationType {
+        UNITARY, BIJECTION, ROTATION, MEASUREMENT
+    };
+
+    /*
+    A single instruction of the circuit. The gate itself is stored in the circuit's list of unitaries, bijections or rotations (depending on the type),
+    at position gateIndex. The wires it acts on are qubitCount consecutive entries of the circuit's qubit list, starting at qubitStart.
+    A controlled gate is followed in the qubit list by its controlCount control wires, which must have the values in controlValues.
+    */
+    struct Operation{
+        OperationType type;
+        int gateIndex;
+        int qubitStart;
+        int qubitCount;
+        int controlCount;
+        StateIndex controlValues;
+    };
+
+    private:
+    std::vector<Operation> operations;
+    std::vector<int> qubitList;
+
+    std::vector<Unitary> unitaries;
+    std::vector<Bijection> bijections;
+    std::vector<Rotation> rotations;
+
+    void addOperation(OperationType type, int gateIndex, const std::vector<int>& qubits, const std::vector<int>& controls = {}, StateIndex controlValues = ALL_CONTROLS_ONE);
+
+    public:
+    Circuit();
+
+    // These record a gate (or a measurement) in the circuit, with the same meaning as the corresponding QuantumRegister functions.
+    void addUnitary(const Unitary& u, const std::vector<int>& qubits);
+    void addBijection(const Bijection& f, const std::vector<int>& qubits);
+    void addRotation(const Rotation& f, const std::vector<int>& qubits);
+    void addMeasurement(const std::vector<int>& qubits);
+
+    // Records a controlled gate (see the controlled versions of QuantumRegister::applyUnitary).
+    void addUnitary(const Unitary& u, const std::vector<int>& controls, const std::vector<int>& qubits, StateIndex controlValues = ALL_CONTROLS_ONE);
+    void addBijection(const Bijection& f, const std::vector<int>& controls, const std::vector<int>& qubits, StateIndex controlValues = ALL_CONTROLS_ONE);
+    void addRotation(const Rotation& f, const std::vector<int>& controls, const std::vector<int>& qubits, StateIndex controlValues = ALL_CONTROLS_ONE);
+
+    // Records a fixed-size gate (see FixedUnitary.hpp). The circuit stores it as a Unitary, like any other gate.
+    template <int numQubits>
+    void addUnitary(const FixedUnitary<numQubits>& u, const std::vector<int>& qubits){
+        addUnitary(u.toUnitary(), qubits);
+    }
+
+    // Adds all of the operations of another circuit to the end of this one.
+    void append(const Circuit& circuit);
+
+    int size() const;
+    const std::vector<Operation>& getOperations() const;
+    std::vector<int> getQubits(const Operation& operation) const;
+    std::vector<int> getControls(const Operation& operation) const;
+    const Unitary& getUnitary(const Operation& operation) const;
+    const Bijection& getBijection(const Operation& operation) const;
+    const Rotation& getRotation(const Operation& operation) const;
+
+    /*
+    Returns an equivalent circuit where runs of consecutive unitaries are fused into a single unitary, as long as the fused unitary acts on
+    at most maxWidth qubits. Every gate is a full pass over the state, so fewer (but wider) gates means much less memory traffic.
+    Bijections, rotations, measurements and controlled unitaries are left as they are, and unitaries cannot be fused across them.
+    */
+    Circuit fused(int maxWidth = 4) const;
+
+    /*
+    Runs the circuit on a quantum register, one operation at a time.
+    Returns the outcomes of the measurements in the order they appear in the circuit.
+
+    While the register is dense, consecutive unitaries that only act on qubits stored in the lowest blockQubits bits of the state index are
+    applied together, one block of 2^blockQubits states at a time (see QuantumRegister::applyUnitariesBlocked), so each block is loaded into
+    cache once per group of gates instead of once per gate. When the upcoming unitaries use other qubits, they are first swapped into the low bits
+    (and swapped back at the end), as long as this saves passes over the state. Set blockQubits to 0 to apply every operation on its own.
+    */
+    std::vector<BasisState> execute(QuantumRegister& qr, int blockQubits = 14) const;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,165 @@
+#ifndef FIXED_UNITARY_HPP
+#define FIXED_UNITARY_HPP
+
+#include "Unitary.hpp"
+#include <array>
+#include <complex>
+#include <cmath>
+
+/*
+A unitary on a fixed number of qubits, known at compile time. The 2^numQubits x 2^numQubits entries are stored row by row in a std::array,
+so building a gate never allocates, copying it is a plain memory copy, and the standard gates below are compile-time constants.
+QuantumRegister has overloads of applyUnitary for one- and two-qubit gates that read the entries directly, in every representation, instead of building a Unitary.
+Use Unitary for gates whose size is only known at runtime (e.g. fused gates), or toUnitary to convert.
+*/
+template <int numQubits>
+class FixedUnitary{
+    public:
+    static constexpr int SIZE = 1 << numQubits;
+    using Entries = std::array<std::complex<double>, SIZE * SIZE>;
+
+    private:
+    Entries entries;
+
+    // std::complex only has constexpr arithmetic from C++20 on, so the constexpr operations below multiply through real() and imag().
+    static constexpr std::complex<double> multiply(std::complex<double> a, std::complex<double> b){
+        return std::complex<double>(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+    }
+    static constexpr std::complex<double> add(std::complex<double> a, std::complex<double> b){
+        return std::complex<double>(a.real() + b.real(), a.imag() + b.imag());
+    }
+
+    template <int otherQubits>
+    friend class FixedUnitary;
+
+    public:
+    constexpr FixedUnitary(): entries() {}
+    constexpr explicit FixedUnitary(const Entries& _entries): entries(_entries) {}
+
+    static constexpr int size(){
+        return SIZE;
+    }
+
+    // Returns row i, so that u[i][j] is the entry in row i and column j (as with Unitary).
+    constexpr const std::complex<double>* operator[](int i) const {
+        return &entries[i * SIZE];
+    }
+    constexpr const std::complex<double>* data() const {
+        return entries.data();
+    }
+
+    constexpr bool isDiagonal() const {
+        for(int i = 0; i < SIZE; i++){
+            for(int j = 0; j < SIZE; j++){
+                if(i != j && entries[i * SIZE + j] != std::complex<double>()){
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Returns true if every column has exactly one non-zero entry, so the gate only moves states around (e.g. X, CNOT and SWAP).
+    constexpr bool isPermutation() const {
+        for(int j = 0; j < SIZE; j++){
+            int nonZero = 0;
+            for(int i = 0; i < SIZE; i++){
+                nonZero += entries[i * SIZE + j] != std::complex<double>();
+            }
+            if(nonZero != 1){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    constexpr FixedUnitary operator*(const FixedUnitary& u) const {
+        FixedUnitary v;
+        for(int i = 0; i < SIZE; i++){
+            for(int j = 0; j < SIZE; j++){
+                std::complex<double> sum;
+                for(int k = 0; k < SIZE; k++){
+                    sum = add(sum, multiply(entries[i * SIZE + k], u.entries[k * SIZE + j]));
+                }
+                v.entries[i * SIZE + j] = sum;
+            }
+        }
+        return v;
+    }
+
+    template <int otherQubits>
+    constexpr FixedUnitary<numQubits + otherQubits> tensor(const FixedUnitary<otherQubits>& u) const {
+        constexpr int m = FixedUnitary<otherQubits>::SIZE;
+        FixedUnitary<numQubits + otherQubits> v;
+        for(int i = 0; i < SIZE; i++){
+            for(int j = 0; j < SIZE; j++){
+                for(int k = 0; k < m; k++){
+                    for(int l = 0; l < m; l++){
+                        v.entries[(i*m + k) * (SIZE * m) + (j*m + l)] = multiply(entries[i * SIZE + j], u.entries[k * m + l]);
+                    }
+                }
+            }
+        }
+        return v;
+    }
+
+    // The same gate with an extra control qubit in front, which applies the gate when it is 1.
+    constexpr FixedUnitary<numQubits + 1> controlled() const {
+        FixedUnitary<numQubits + 1> v;
+        for(int i = 0; i < SIZE; i++){
+            v.entries[i * (2 * SIZE) + i] = std::complex<double>(1);
+            for(int j = 0; j < SIZE; j++){
+                v.entries[(i + SIZE) * (2 * SIZE) + (j + SIZE)] = entries[i * SIZE + j];
+            }
+        }
+        return v;
+    }
+
+    // The conjugate transpose, which is the inverse of a unitary.
+    constexpr FixedUnitary adjoint() const {
+        FixedUnitary v;
+        for(int i = 0; i < SIZE; i++){
+            for(int j = 0; j < SIZE; j++){
+                v.entries[i * SIZE + j] = std::complex<double>(entries[j * SIZE + i].real(), -entries[j * SIZE + i].imag());
+            }
+        }
+        return v;
+    }
+
+    // Copies the entries into a Unitary, which stores them row by row as well.
+    Unitary toUnitary() const {
+        return Unitary(SIZE, AmplitudeVector(entries.begin(), entries.end()));
+    }
+};
+
+// The standard gates as compile-time constants, with the same matrices as the matching static functions of Unitary.
+namespace Gates{
+    constexpr double INV_SQRT2 = 0.70710678118654752440;
+
+    inline constexpr FixedUnitary<1> I({1, 0, 0, 1});
+    inline constexpr FixedUnitary<1> X({0, 1, 1, 0});
+    inline constexpr FixedUnitary<1> Y({0, std::complex<double>(0, -1), std::complex<double>(0, 1), 0});
+    inline constexpr FixedUnitary<1> Z({1, 0, 0, -1});
+    inline constexpr FixedUnitary<1> H({INV_SQRT2, INV_SQRT2, INV_SQRT2, -INV_SQRT2});
+    inline constexpr FixedUnitary<1> S({1, 0, 0, std::complex<double>(0, 1)});
+    inline constexpr FixedUnitary<1> T({1, 0, 0, std::complex<double>(INV_SQRT2, INV_SQRT2)});
+
+    inline constexpr FixedUnitary<2> CNOT = X.controlled();
+    inline constexpr FixedUnitary<2> CZ = Z.controlled();
+    inline constexpr FixedUnitary<2> SWAP({
+        1, 0, 0, 0,
+        0, 0, 1, 0,
+        0, 1, 0, 0,
+        0, 0, 0, 1
+    });
+
+    // Phase gates depend on an angle, so they cannot be constants, but they are still built without allocating.
+    inline FixedUnitary<1> phase(double theta){
+        return FixedUnitary<1>({1, 0, 0, std::polar(1.0, theta)});
+    }
+    inline FixedUnitary<2> controlledPhase(double theta){
+        return phase(theta).controlled();
+    }
+}
+
+#endif
\ No newline at end of file
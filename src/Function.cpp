@@ -1,44 +1,61 @@
 #include "Function.hpp"
 #include <cassert>
 
-Bijection::Bijection(const std::vector<int>& _f): f(_f) {}
+Bijection::Bijection(std::vector<StateIndex> _f): numValues(_f.size()), f(std::move(_f)) {}
 
-int Bijection::size() const {
-    return f.size();
+Bijection::Bijection(StateIndex size, std::function<StateIndex(StateIndex)> _function): numValues(size), function(std::move(_function)) {}
+
+StateIndex Bijection::size() const {
+    return numValues;
 }
 
-int Bijection::apply(int x) const {
-    assert(x >= 0 && x < this->size());
-    return f[x];
+StateIndex Bijection::apply(StateIndex x) const {
+    assert(x < this->size());
+    return function ? function(x) : f[x];
 }
 
 Bijection Bijection::controlled() const {
-    int n = this->size();
-    std::vector<int> g(2*n);
-    for(int i = 0; i < n; i++){
+    StateIndex n = this->size();
+    if(function){
+        std::function<StateIndex(StateIndex)> g = function;
+        return Bijection(2*n, [n, g](StateIndex x){
+            return x < n ? x : g(x - n) + n;
+        });
+    }
+    std::vector<StateIndex> g(2*n);
+    for(StateIndex i = 0; i < n; i++){
         g[i] = i;
     }
-    for(int i = n; i < 2*n; i++){
+    for(StateIndex i = n; i < 2*n; i++){
         g[i] = this->f[i-n] + n;
     }
-    return Bijection(g);
+    return Bijection(std::move(g));
 }
 
-Rotation::Rotation(const std::vector<std::complex<double>>& _f): f(_f) {}
+Rotation::Rotation(std::vector<std::complex<double>> _f): numValues(_f.size()), f(std::move(_f)) {}
 
-int Rotation::size() const {
-    return f.size();
+Rotation::Rotation(StateIndex size, std::function<std::complex<double>(StateIndex)> _function): numValues(size), function(std::move(_function)) {}
+
+StateIndex Rotation::size() const {
+    return numValues;
 }
 
-std::complex<double> Rotation::getRotation(int x) const {
-    return f[x];
+std::complex<double> Rotation::getRotation(StateIndex x) const {
+    assert(x < this->size());
+    return function ? function(x) : f[x];
 }
 
 Rotation Rotation::controlled() const {
-    int n = this->size();
+    StateIndex n = this->size();
+    if(function){
+        std::function<std::complex<double>(StateIndex)> g = function;
+        return Rotation(2*n, [n, g](StateIndex x){
+            return x < n ? std::complex<double>(1) : g(x - n);
+        });
+    }
     std::vector<std::complex<double>> g(2*n, 1);
-    for(int i = n; i < 2*n; i++){
+    for(StateIndex i = n; i < 2*n; i++){
         g[i] = this->f[i-n];
     }
-    return Rotation(g);
+    return Rotation(std::move(g));
 }
\ No newline at end of file
@@ -1,22 +1,33 @@
 #ifndef FUNCTION_HPP
 #define FUNCTION_HPP
 
+#include "BasisState.hpp"
 #include <vector>
 #include <complex>
+#include <functional>
 
 /*
 Represents a bijection, that is, a one-to-one mapping.
 We could instead represent this as a unitary matrix, but the matrix would have O(n^2) zeros,
 so we can save computation time by only storing a mapping of size O(n).
+
+The mapping is either a table, or a function that is called whenever the image of a value is needed. A sparse register only calls it for the
+values that actually occur in its superposition, so a wide oracle given as a function never needs a table of size 2^m at all.
 */
 class Bijection{
     private:
-    const std::vector<int> f;
+    const StateIndex numValues;
+    const std::vector<StateIndex> f;
+    const std::function<StateIndex(StateIndex)> function;
 
     public:
-    Bijection(const std::vector<int>& f);
-    int size() const;
-    int apply(int x) const;
+    Bijection(std::vector<StateIndex> f);
+
+    // The bijection on the values 0 to size - 1 (size must be a power of 2) that sends x to function(x).
+    Bijection(StateIndex size, std::function<StateIndex(StateIndex)> function);
+
+    StateIndex size() const;
+    StateIndex apply(StateIndex x) const;
     Bijection controlled() const;
 };
 
@@ -24,15 +35,22 @@ class Bijection{
 Represents a rotation, which multiplies each qubit by some complex number of magnitude 1.
 Similar to the bijection, we could instead represent this as a unitary matrix, but the matrix would have O(n^2) zeros,
 so we can save computation time by only storing a mapping of size O(n).
+Like a bijection, the rotations can also be given as a function instead of a table.
 */
 class Rotation{
     private:
+    const StateIndex numValues;
     const std::vector<std::complex<double>> f;
+    const std::function<std::complex<double>(StateIndex)> function;
 
     public:
-    Rotation(const std::vector<std::complex<double>>& f);
-    int size() const;
-    std::complex<double> getRotation(int x) const;
+    Rotation(std::vector<std::complex<double>> f);
+
+    // The rotation on the values 0 to size - 1 (size must be a power of 2) that multiplies x by function(x).
+    Rotation(StateIndex size, std::function<std::complex<double>(StateIndex)> function);
+
+    StateIndex size() const;
+    std::complex<double> getRotation(StateIndex x) const;
     Rotation controlled() const;
 };
 
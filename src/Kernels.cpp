@@ -0,0 +1,474 @@
+#include "Kernels.hpp"
+#include <atomic>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+void applyPairKernelScalar(std::complex<double>* x, long long length, long long stride, const std::complex<double> (&u)[2][2]){
+    for(long long k = 0; k < length; k++){
+        std::complex<double> a0 = x[k];
+        std::complex<double> a1 = x[k + stride];
+        x[k] = multiplyComplex(u[0][0], a0) + multiplyComplex(u[0][1], a1);
+        x[k + stride] = multiplyComplex(u[1][0], a0) + multiplyComplex(u[1][1], a1);
+    }
+}
+
+void applyAdjacentPairKernelScalar(std::complex<double>* x, long long numPairs, const std::complex<double> (&u)[2][2]){
+    for(long long p = 0; p < numPairs; p++){
+        applyPairKernelScalar(x + 2*p, 1, 1, u);
+    }
+}
+
+/*
+The matrix kernels for a size known at compile time (4, for two-qubit gates). The loops over the matrix are then fully unrolled,
+and the inputs of a group stay in registers instead of going through scratch.
+*/
+template <int SIZE>
+void applyFixedMatrixKernelScalar(std::complex<double>* x, long long length, const std::uint64_t* offsets, const std::complex<double>* matrix){
+    for(long long k = 0; k < length; k++){
+        std::complex<double> input[SIZE];
+        for(int c = 0; c < SIZE; c++){
+            input[c] = x[offsets[c] + k];
+        }
+        for(int r = 0; r < SIZE; r++){
+            std::complex<double> sum = 0;
+            for(int c = 0; c < SIZE; c++){
+                sum += multiplyComplex(matrix[r*SIZE + c], input[c]);
+            }
+            x[offsets[r] + k] = sum;
+        }
+    }
+}
+
+void applyMatrixKernelScalar(std::complex<double>* x, long long length, const std::uint64_t* offsets, int size, const std::complex<double>* matrix, std::complex<double>* scratch){
+    if(size == 4){
+        applyFixedMatrixKernelScalar<4>(x, length, offsets, matrix);
+        return;
+    }
+    for(long long k = 0; k < length; k++){
+        for(int c = 0; c < size; c++){
+            scratch[c] = x[offsets[c] + k];
+        }
+        for(int r = 0; r < size; r++){
+            std::complex<double> sum = 0;
+            for(int c = 0; c < size; c++){
+                sum += multiplyComplex(matrix[r*size + c], scratch[c]);
+            }
+            x[offsets[r] + k] = sum;
+        }
+    }
+}
+
+void multiplyKernelScalar(std::complex<double>* x, const std::complex<double>* z, long long length){
+    for(long long k = 0; k < length; k++){
+        x[k] = multiplyComplex(x[k], z[k]);
+    }
+}
+
+void scaleKernelScalar(std::complex<double>* x, long long length, std::complex<double> z){
+    for(long long k = 0; k < length; k++){
+        x[k] = multiplyComplex(x[k], z);
+    }
+}
+
+void addScaledKernelScalar(std::complex<double>* y, const std::complex<double>* x, long long length, std::complex<double> z){
+    for(long long k = 0; k < length; k++){
+        y[k] += multiplyComplex(x[k], z);
+    }
+}
+
+double normKernelScalar(const std::complex<double>* x, long long length){
+    double sum = 0;
+    for(long long k = 0; k < length; k++){
+        sum += x[k].real() * x[k].real() + x[k].imag() * x[k].imag();
+    }
+    return sum;
+}
+
+#ifdef KERNELS_X86
+
+/*
+The AVX kernels work directly on interleaved (real, imaginary) pairs, so a 256-bit register holds two amplitudes and a 512-bit register holds four.
+To multiply x by y, we use x * y = (x.re * y.re - x.im * y.im, x.im * y.re + x.re * y.im), which is a single fused multiply-add/subtract
+of x with y.re and of x with its real and imaginary parts swapped with y.im.
+*/
+
+__attribute__((target("avx2,fma")))
+inline __m256d multiplyAvx2(__m256d x, __m256d yRe, __m256d yIm){
+    __m256d swapped = _mm256_permute_pd(x, 0x5);
+    return _mm256_fmaddsub_pd(x, yRe, _mm256_mul_pd(swapped, yIm));
+}
+
+__attribute__((target("avx2,fma")))
+void applyPairKernelAvx2(std::complex<double>* x, long long length, long long stride, const std::complex<double> (&u)[2][2]){
+    __m256d u00Re = _mm256_set1_pd(u[0][0].real()), u00Im = _mm256_set1_pd(u[0][0].imag());
+    __m256d u01Re = _mm256_set1_pd(u[0][1].real()), u01Im = _mm256_set1_pd(u[0][1].imag());
+    __m256d u10Re = _mm256_set1_pd(u[1][0].real()), u10Im = _mm256_set1_pd(u[1][0].imag());
+    __m256d u11Re = _mm256_set1_pd(u[1][1].real()), u11Im = _mm256_set1_pd(u[1][1].imag());
+
+    long long k = 0;
+    if(stride >= 2){
+        for(; k + 2 <= length; k += 2){
+            double* p0 = reinterpret_cast<double*>(x + k);
+            double* p1 = reinterpret_cast<double*>(x + k + stride);
+            __m256d a0 = _mm256_loadu_pd(p0);
+            __m256d a1 = _mm256_loadu_pd(p1);
+            __m256d b0 = _mm256_add_pd(multiplyAvx2(a0, u00Re, u00Im), multiplyAvx2(a1, u01Re, u01Im));
+            __m256d b1 = _mm256_add_pd(multiplyAvx2(a0, u10Re, u10Im), multiplyAvx2(a1, u11Re, u11Im));
+            _mm256_storeu_pd(p0, b0);
+            _mm256_storeu_pd(p1, b1);
+        }
+    }
+    applyPairKernelScalar(x + k, length - k, stride, u);
+}
+
+__attribute__((target("avx2,fma")))
+void applyAdjacentPairKernelAvx2(std::complex<double>* x, long long numPairs, const std::complex<double> (&u)[2][2]){
+    // Each register holds one pair (a0, a1). We broadcast a0 and a1 to both halves and multiply them by the columns (u00, u10) and (u01, u11).
+    __m256d column0Re = _mm256_setr_pd(u[0][0].real(), u[0][0].real(), u[1][0].real(), u[1][0].real());
+    __m256d column0Im = _mm256_setr_pd(u[0][0].imag(), u[0][0].imag(), u[1][0].imag(), u[1][0].imag());
+    __m256d column1Re = _mm256_setr_pd(u[0][1].real(), u[0][1].real(), u[1][1].real(), u[1][1].real());
+    __m256d column1Im = _mm256_setr_pd(u[0][1].imag(), u[0][1].imag(), u[1][1].imag(), u[1][1].imag());
+    for(long long p = 0; p < numPairs; p++){
+        double* pair = reinterpret_cast<double*>(x + 2*p);
+        __m256d a = _mm256_loadu_pd(pair);
+        __m256d a0 = _mm256_permute2f128_pd(a, a, 0x00);
+        __m256d a1 = _mm256_permute2f128_pd(a, a, 0x11);
+        _mm256_storeu_pd(pair, _mm256_add_pd(multiplyAvx2(a0, column0Re, column0Im), multiplyAvx2(a1, column1Re, column1Im)));
+    }
+}
+
+template <int SIZE>
+__attribute__((target("avx2,fma")))
+void applyFixedMatrixKernelAvx2(std::complex<double>* x, long long length, const std::uint64_t* offsets, const std::complex<double>* matrix){
+    const double* entries = reinterpret_cast<const double*>(matrix);
+    long long k = 0;
+    for(; k + 2 <= length; k += 2){
+        __m256d input[SIZE];
+        for(int c = 0; c < SIZE; c++){
+            input[c] = _mm256_loadu_pd(reinterpret_cast<double*>(x + offsets[c] + k));
+        }
+        for(int r = 0; r < SIZE; r++){
+            __m256d sum = _mm256_setzero_pd();
+            for(int c = 0; c < SIZE; c++){
+                const double* entry = entries + 2*(r*SIZE + c);
+                sum = _mm256_add_pd(sum, multiplyAvx2(input[c], _mm256_broadcast_sd(entry), _mm256_broadcast_sd(entry + 1)));
+            }
+            _mm256_storeu_pd(reinterpret_cast<double*>(x + offsets[r] + k), sum);
+        }
+    }
+    applyFixedMatrixKernelScalar<SIZE>(x + k, length - k, offsets, matrix);
+}
+
+__attribute__((target("avx2,fma")))
+void applyMatrixKernelAvx2(std::complex<double>* x, long long length, const std::uint64_t* offsets, int size, const std::complex<double>* matrix, std::complex<double>* scratch){
+    if(size == 4){
+        applyFixedMatrixKernelAvx2<4>(x, length, offsets, matrix);
+        return;
+    }
+
+    // Work on two groups at a time. The inputs are copied to scratch first, since the outputs overwrite them.
+    const double* entries = reinterpret_cast<const double*>(matrix);
+    double* input = reinterpret_cast<double*>(scratch);
+    long long k = 0;
+    for(; k + 2 <= length; k += 2){
+        for(int c = 0; c < size; c++){
+            _mm256_storeu_pd(input + 4*c, _mm256_loadu_pd(reinterpret_cast<double*>(x + offsets[c] + k)));
+        }
+        for(int r = 0; r < size; r++){
+            __m256d sum = _mm256_setzero_pd();
+            for(int c = 0; c < size; c++){
+                const double* entry = entries + 2*(r*size + c);
+                __m256d product = multiplyAvx2(_mm256_loadu_pd(input + 4*c), _mm256_broadcast_sd(entry), _mm256_broadcast_sd(entry + 1));
+                sum = _mm256_add_pd(sum, product);
+            }
+            _mm256_storeu_pd(reinterpret_cast<double*>(x + offsets[r] + k), sum);
+        }
+    }
+    applyMatrixKernelScalar(x + k, length - k, offsets, size, matrix, scratch);
+}
+
+__attribute__((target("avx2,fma")))
+void multiplyKernelAvx2(std::complex<double>* x, const std::complex<double>* z, long long length){
+    long long k = 0;
+    for(; k + 2 <= length; k += 2){
+        double* p = reinterpret_cast<double*>(x + k);
+        __m256d factors = _mm256_loadu_pd(reinterpret_cast<const double*>(z + k));
+        _mm256_storeu_pd(p, multiplyAvx2(_mm256_loadu_pd(p), _mm256_movedup_pd(factors), _mm256_permute_pd(factors, 0xF)));
+    }
+    multiplyKernelScalar(x + k, z + k, length - k);
+}
+
+__attribute__((target("avx2,fma")))
+void scaleKernelAvx2(std::complex<double>* x, long long length, std::complex<double> z){
+    __m256d zRe = _mm256_set1_pd(z.real()), zIm = _mm256_set1_pd(z.imag());
+    long long k = 0;
+    for(; k + 2 <= length; k += 2){
+        double* p = reinterpret_cast<double*>(x + k);
+        _mm256_storeu_pd(p, multiplyAvx2(_mm256_loadu_pd(p), zRe, zIm));
+    }
+    scaleKernelScalar(x + k, length - k, z);
+}
+
+__attribute__((target("avx2,fma")))
+void addScaledKernelAvx2(std::complex<double>* y, const std::complex<double>* x, long long length, std::complex<double> z){
+    __m256d zRe = _mm256_set1_pd(z.real()), zIm = _mm256_set1_pd(z.imag());
+    long long k = 0;
+    for(; k + 2 <= length; k += 2){
+        double* p = reinterpret_cast<double*>(y + k);
+        __m256d product = multiplyAvx2(_mm256_loadu_pd(reinterpret_cast<const double*>(x + k)), zRe, zIm);
+        _mm256_storeu_pd(p, _mm256_add_pd(_mm256_loadu_pd(p), product));
+    }
+    addScaledKernelScalar(y + k, x + k, length - k, z);
+}
+
+// Uses two accumulators, so that each addition does not have to wait for the one before it.
+__attribute__((target("avx2,fma")))
+double normKernelAvx2(const std::complex<double>* x, long long length){
+    const double* p = reinterpret_cast<const double*>(x);
+    __m256d sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+    long long k = 0;
+    for(; k + 4 <= length; k += 4){
+        __m256d a0 = _mm256_loadu_pd(p + 2*k), a1 = _mm256_loadu_pd(p + 2*k + 4);
+        sum0 = _mm256_fmadd_pd(a0, a0, sum0);
+        sum1 = _mm256_fmadd_pd(a1, a1, sum1);
+    }
+    double parts[4];
+    _mm256_storeu_pd(parts, _mm256_add_pd(sum0, sum1));
+    return (parts[0] + parts[1]) + (parts[2] + parts[3]) + normKernelScalar(x + k, length - k);
+}
+
+__attribute__((target("avx512f")))
+inline __m512d multiplyAvx512(__m512d x, __m512d yRe, __m512d yIm){
+    __m512d swapped = _mm512_shuffle_pd(x, x, 0x55);
+    return _mm512_fmaddsub_pd(x, yRe, _mm512_mul_pd(swapped, yIm));
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+void applyPairKernelAvx512(std::complex<double>* x, long long length, long long stride, const std::complex<double> (&u)[2][2]){
+    if(stride < 4){
+        applyPairKernelAvx2(x, length, stride, u);
+        return;
+    }
+
+    __m512d u00Re = _mm512_set1_pd(u[0][0].real()), u00Im = _mm512_set1_pd(u[0][0].imag());
+    __m512d u01Re = _mm512_set1_pd(u[0][1].real()), u01Im = _mm512_set1_pd(u[0][1].imag());
+    __m512d u10Re = _mm512_set1_pd(u[1][0].real()), u10Im = _mm512_set1_pd(u[1][0].imag());
+    __m512d u11Re = _mm512_set1_pd(u[1][1].real()), u11Im = _mm512_set1_pd(u[1][1].imag());
+
+    long long k = 0;
+    for(; k + 4 <= length; k += 4){
+        double* p0 = reinterpret_cast<double*>(x + k);
+        double* p1 = reinterpret_cast<double*>(x + k + stride);
+        __m512d a0 = _mm512_loadu_pd(p0);
+        __m512d a1 = _mm512_loadu_pd(p1);
+        __m512d b0 = _mm512_add_pd(multiplyAvx512(a0, u00Re, u00Im), multiplyAvx512(a1, u01Re, u01Im));
+        __m512d b1 = _mm512_add_pd(multiplyAvx512(a0, u10Re, u10Im), multiplyAvx512(a1, u11Re, u11Im));
+        _mm512_storeu_pd(p0, b0);
+        _mm512_storeu_pd(p1, b1);
+    }
+    applyPairKernelAvx2(x + k, length - k, stride, u);
+}
+
+template <int SIZE>
+__attribute__((target("avx512f,avx2,fma")))
+void applyFixedMatrixKernelAvx512(std::complex<double>* x, long long length, const std::uint64_t* offsets, const std::complex<double>* matrix){
+    const double* entries = reinterpret_cast<const double*>(matrix);
+    long long k = 0;
+    for(; k + 4 <= length; k += 4){
+        __m512d input[SIZE];
+        for(int c = 0; c < SIZE; c++){
+            input[c] = _mm512_loadu_pd(reinterpret_cast<double*>(x + offsets[c] + k));
+        }
+        for(int r = 0; r < SIZE; r++){
+            __m512d sum = _mm512_setzero_pd();
+            for(int c = 0; c < SIZE; c++){
+                const double* entry = entries + 2*(r*SIZE + c);
+                sum = _mm512_add_pd(sum, multiplyAvx512(input[c], _mm512_set1_pd(entry[0]), _mm512_set1_pd(entry[1])));
+            }
+            _mm512_storeu_pd(reinterpret_cast<double*>(x + offsets[r] + k), sum);
+        }
+    }
+    applyFixedMatrixKernelAvx2<SIZE>(x + k, length - k, offsets, matrix);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+void applyMatrixKernelAvx512(std::complex<double>* x, long long length, const std::uint64_t* offsets, int size, const std::complex<double>* matrix, std::complex<double>* scratch){
+    if(size == 4){
+        applyFixedMatrixKernelAvx512<4>(x, length, offsets, matrix);
+        return;
+    }
+
+    // Same as the AVX2 version, but with four groups at a time.
+    const double* entries = reinterpret_cast<const double*>(matrix);
+    double* input = reinterpret_cast<double*>(scratch);
+    long long k = 0;
+    for(; k + 4 <= length; k += 4){
+        for(int c = 0; c < size; c++){
+            _mm512_storeu_pd(input + 8*c, _mm512_loadu_pd(reinterpret_cast<double*>(x + offsets[c] + k)));
+        }
+        for(int r = 0; r < size; r++){
+            __m512d sum = _mm512_setzero_pd();
+            for(int c = 0; c < size; c++){
+                const double* entry = entries + 2*(r*size + c);
+                __m512d product = multiplyAvx512(_mm512_loadu_pd(input + 8*c), _mm512_set1_pd(entry[0]), _mm512_set1_pd(entry[1]));
+                sum = _mm512_add_pd(sum, product);
+            }
+            _mm512_storeu_pd(reinterpret_cast<double*>(x + offsets[r] + k), sum);
+        }
+    }
+    applyMatrixKernelAvx2(x + k, length - k, offsets, size, matrix, scratch);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+void multiplyKernelAvx512(std::complex<double>* x, const std::complex<double>* z, long long length){
+    long long k = 0;
+    for(; k + 4 <= length; k += 4){
+        double* p = reinterpret_cast<double*>(x + k);
+        __m512d factors = _mm512_loadu_pd(reinterpret_cast<const double*>(z + k));
+        _mm512_storeu_pd(p, multiplyAvx512(_mm512_loadu_pd(p), _mm512_shuffle_pd(factors, factors, 0x00), _mm512_shuffle_pd(factors, factors, 0xFF)));
+    }
+    multiplyKernelAvx2(x + k, z + k, length - k);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+void scaleKernelAvx512(std::complex<double>* x, long long length, std::complex<double> z){
+    __m512d zRe = _mm512_set1_pd(z.real()), zIm = _mm512_set1_pd(z.imag());
+    long long k = 0;
+    for(; k + 4 <= length; k += 4){
+        double* p = reinterpret_cast<double*>(x + k);
+        _mm512_storeu_pd(p, multiplyAvx512(_mm512_loadu_pd(p), zRe, zIm));
+    }
+    scaleKernelAvx2(x + k, length - k, z);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+void addScaledKernelAvx512(std::complex<double>* y, const std::complex<double>* x, long long length, std::complex<double> z){
+    __m512d zRe = _mm512_set1_pd(z.real()), zIm = _mm512_set1_pd(z.imag());
+    long long k = 0;
+    for(; k + 4 <= length; k += 4){
+        double* p = reinterpret_cast<double*>(y + k);
+        __m512d product = multiplyAvx512(_mm512_loadu_pd(reinterpret_cast<const double*>(x + k)), zRe, zIm);
+        _mm512_storeu_pd(p, _mm512_add_pd(_mm512_loadu_pd(p), product));
+    }
+    addScaledKernelAvx2(y + k, x + k, length - k, z);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+double normKernelAvx512(const std::complex<double>* x, long long length){
+    const double* p = reinterpret_cast<const double*>(x);
+    __m512d sum0 = _mm512_setzero_pd(), sum1 = _mm512_setzero_pd();
+    long long k = 0;
+    for(; k + 8 <= length; k += 8){
+        __m512d a0 = _mm512_loadu_pd(p + 2*k), a1 = _mm512_loadu_pd(p + 2*k + 8);
+        sum0 = _mm512_fmadd_pd(a0, a0, sum0);
+        sum1 = _mm512_fmadd_pd(a1, a1, sum1);
+    }
+    double parts[8];
+    _mm512_storeu_pd(parts, _mm512_add_pd(sum0, sum1));
+    double sum = 0;
+    for(double part : parts){
+        sum += part;
+    }
+    return sum + normKernelAvx2(x + k, length - k);
+}
+
+#endif
+
+// The versions of the kernels that the CPU supports.
+struct KernelTable{
+    void (*pair)(std::complex<double>*, long long, long long, const std::complex<double> (&)[2][2]);
+    void (*adjacentPair)(std::complex<double>*, long long, const std::complex<double> (&)[2][2]);
+    void (*matrix)(std::complex<double>*, long long, const std::uint64_t*, int, const std::complex<double>*, std::complex<double>*);
+    void (*scale)(std::complex<double>*, long long, std::complex<double>);
+    void (*addScaled)(std::complex<double>*, const std::complex<double>*, long long, std::complex<double>);
+    void (*multiply)(std::complex<double>*, const std::complex<double>*, long long);
+    double (*norm)(const std::complex<double>*, long long);
+    const char* name;
+};
+
+// Every version of the kernels that the CPU supports, fastest first. The scalar version is always last.
+std::vector<KernelTable> supportedKernels(){
+    std::vector<KernelTable> tables;
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if(avx2 && __builtin_cpu_supports("avx512f")){
+        tables.push_back(KernelTable{applyPairKernelAvx512, applyAdjacentPairKernelAvx2, applyMatrixKernelAvx512, scaleKernelAvx512, addScaledKernelAvx512, multiplyKernelAvx512, normKernelAvx512, "AVX-512"});
+    }
+    if(avx2){
+        tables.push_back(KernelTable{applyPairKernelAvx2, applyAdjacentPairKernelAvx2, applyMatrixKernelAvx2, scaleKernelAvx2, addScaledKernelAvx2, multiplyKernelAvx2, normKernelAvx2, "AVX2"});
+    }
+#endif
+    tables.push_back(KernelTable{applyPairKernelScalar, applyAdjacentPairKernelScalar, applyMatrixKernelScalar, scaleKernelScalar, addScaledKernelScalar, multiplyKernelScalar, normKernelScalar, "scalar"});
+    return tables;
+}
+
+const std::vector<KernelTable>& allKernels(){
+    static const std::vector<KernelTable> tables = supportedKernels();
+    return tables;
+}
+
+// The version picked by forceKernelInstructionSet, or nullptr for the fastest one. Atomic since the kernels are called from the threads of the pool.
+std::atomic<const KernelTable*> forcedKernels(nullptr);
+
+const KernelTable& kernels(){
+    const KernelTable* forced = forcedKernels.load(std::memory_order_relaxed);
+    return forced ? *forced : allKernels()[0];
+}
+
+void applyPairKernel(std::complex<double>* x, long long length, long long stride, const std::complex<double> (&u)[2][2]){
+    kernels().pair(x, length, stride, u);
+}
+
+void applyAdjacentPairKernel(std::complex<double>* x, long long numPairs, const std::complex<double> (&u)[2][2]){
+    kernels().adjacentPair(x, numPairs, u);
+}
+
+void applyMatrixKernel(std::complex<double>* x, long long length, const std::uint64_t* offsets, int size, const std::complex<double>* matrix, std::complex<double>* scratch){
+    kernels().matrix(x, length, offsets, size, matrix, scratch);
+}
+
+void scaleKernel(std::complex<double>* x, long long length, std::complex<double> z){
+    kernels().scale(x, length, z);
+}
+
+void addScaledKernel(std::complex<double>* y, const std::complex<double>* x, long long length, std::complex<double> z){
+    kernels().addScaled(y, x, length, z);
+}
+
+void multiplyKernel(std::complex<double>* x, const std::complex<double>* z, long long length){
+    kernels().multiply(x, z, length);
+}
+
+double normKernel(const std::complex<double>* x, long long length){
+    return kernels().norm(x, length);
+}
+
+const char* kernelInstructionSet(){
+    return kernels().name;
+}
+
+std::vector<std::string> supportedInstructionSets(){
+    std::vector<std::string> names;
+    for(const KernelTable& table : allKernels()){
+        names.push_back(table.name);
+    }
+    return names;
+}
+
+bool forceKernelInstructionSet(const std::string& name){
+    if(name.empty()){
+        forcedKernels = nullptr;
+        return true;
+    }
+    for(const KernelTable& table : allKernels()){
+        if(table.name == name){
+            forcedKernels = &table;
+            return true;
+        }
+    }
+    return false;
+}
\ No newline at end of file
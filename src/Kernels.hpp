@@ -0,0 +1,62 @@
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+
+#include <complex>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+Vectorized inner loops over a dense amplitude array.
+Each function has an AVX-512, an AVX2 (with FMA) and a portable scalar version, and the fastest one the CPU supports is picked the first time a kernel is used (unless forceKernelInstructionSet is called).
+All versions avoid std::complex multiplication, which checks for NaN and infinity on every product unless we compile with -ffast-math.
+*/
+
+// Multiplies two complex numbers without the NaN and infinity checks of std::complex (also used by the matrix products in Unitary.cpp).
+inline std::complex<double> multiplyComplex(std::complex<double> a, std::complex<double> b){
+    return std::complex<double>(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+}
+
+/*
+Applies the 2x2 unitary u to length pairs of amplitudes, where pair k is made up of x[k] (the qubit is 0) and x[k + stride] (the qubit is 1).
+*/
+void applyPairKernel(std::complex<double>* x, long long length, long long stride, const std::complex<double> (&u)[2][2]);
+
+/*
+Same as applyPairKernel with a stride of 1, applied to numPairs consecutive pairs (x[0], x[1]), (x[2], x[3]), ...
+This is the layout of the least significant qubit.
+*/
+void applyAdjacentPairKernel(std::complex<double>* x, long long numPairs, const std::complex<double> (&u)[2][2]);
+
+/*
+Applies a size x size matrix (stored row by row) to length groups of amplitudes, where group k is made up of x[offsets[0] + k], ..., x[offsets[size - 1] + k].
+This is how a gate on several qubits is applied to a run of consecutive states. scratch must have room for 4 * size amplitudes.
+*/
+void applyMatrixKernel(std::complex<double>* x, long long length, const std::uint64_t* offsets, int size, const std::complex<double>* matrix, std::complex<double>* scratch);
+
+// Multiplies length consecutive amplitudes by z.
+void scaleKernel(std::complex<double>* x, long long length, std::complex<double> z);
+
+// Adds z times each of length consecutive entries of x to the matching entry of y (y[k] += z * x[k]).
+void addScaledKernel(std::complex<double>* y, const std::complex<double>* x, long long length, std::complex<double> z);
+
+// Multiplies each of length consecutive amplitudes by the matching entry of z (x[k] *= z[k]).
+void multiplyKernel(std::complex<double>* x, const std::complex<double>* z, long long length);
+
+// Returns the total probability of length consecutive amplitudes, that is, the sum of their squared absolute values.
+double normKernel(const std::complex<double>* x, long long length);
+
+// Returns the name of the instruction set the kernels are using ("AVX-512", "AVX2" or "scalar").
+const char* kernelInstructionSet();
+
+// Returns the names of every instruction set the CPU can run the kernels with, fastest first (the last one is always "scalar").
+std::vector<std::string> supportedInstructionSets();
+
+/*
+Makes every kernel use the version for the given instruction set (one of supportedInstructionSets), or the fastest one again if name is empty.
+This lets tests check the versions against each other on CPUs where the slower ones would otherwise never run. Returns false if the CPU does not
+support the instruction set. Must not be called while gates are being applied.
+*/
+bool forceKernelInstructionSet(const std::string& name);
+
+#endif
\ No newline at end of file
@@ -6,6 +6,29 @@ void runAllTests(){
     testGrover();
     testQFT();
     testShor();
+    testRepresentations();
+    testAdaptiveRepresentation();
+    testUnitaryStructure();
+    testMultithreading();
+    testKernels();
+    testCircuit();
+    testFusion();
+    testBlockedExecution();
+    testQubitGather();
+    testLargeRegister();
+    testAmplitudeMap();
+    testLargeMeasurement();
+    testSample();
+    testPruning();
+    testFixedUnitary();
+    testMatrixOperations();
+    testControlledGates();
+    testCallableOracles();
+    testModularMultiplication();
+    testStructuredShor();
+    testFFTQFT();
+    testApproximateQFT();
+    testBatchedRegister();
 }
 
 int main(){
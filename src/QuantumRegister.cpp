@@ -1,193 +1,2177 @@
 #include "QuantumRegister.hpp"
 #include "Random.hpp"
+#include "Kernels.hpp"
+#include "QubitGather.hpp"
+#include "Math.hpp"
 #include <cassert>
 #include <unordered_set>
 #include <map>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// The largest register we allow at all, since a state is indexed with a StateIndex. Registers this large can only be stored sparsely.
+const int MAX_QUBITS = 8 * sizeof(StateIndex);
+
+/*
+The largest register we allow to be stored densely. A dense register with n qubits holds 2^n coefficients (16 bytes each).
+*/
+const int MAX_DENSE_QUBITS = 30;
+
+/*
+The Fourier transform of a dense register (see applyFourierTransform) runs the first stages of its FFT on blocks of at most 2^FOURIER_BLOCK_QUBITS
+amplitudes (256 KB), one block at a time, so that each block stays in cache through all of the stages that only mix amplitudes inside it.
+*/
+const int FOURIER_BLOCK_QUBITS = 14;
+
+// The later stages of the FFT work out the twiddles of this many butterflies at a time.
+const long long FOURIER_TWIDDLE_CHUNK = 1024;
+
+/*
+Dense measurements split the work into this many parts, each of which adds up its own probabilities. The parts are then added up in a fixed order,
+so the result does not depend on the number of threads.
+*/
+const long long MEASURE_PARTS = 64;
+
+/*
+When measuring at most this many qubits, a dense measurement adds up the probability of every outcome (in every part) in its first pass.
+With more qubits, this would take too much memory, so it picks a state instead (see measureDense).
+*/
+const int MAX_MEASURE_OUTCOME_QUBITS = 12;
+
+/*
+Helpers for the dense representation.
+Since qubit 0 is the most significant bit of a state, qubit q of an n qubit register is stored in bit n - 1 - q.
+*/
+
+// Returns the bit of a state that holds the given qubit.
+int qubitBitPosition(int qubit, int numQubits){
+    return numQubits - 1 - qubit;
+}
+
+/*
+For each of the 2^m values that the m qubits in qubits can take, compute the bits this value sets in a full state.
+Value s sets qubits[k] to bit m - 1 - k of s, matching the convention used by BasisState.
+*/
+std::vector<StateIndex> subStateOffsets(const std::vector<int>& qubits, int numQubits){
+    int m = qubits.size();
+    std::vector<StateIndex> bits(m);
+    for(int k = 0; k < m; k++){
+        bits[m - 1 - k] = StateIndex(1) << qubitBitPosition(qubits[k], numQubits);
+    }
+    // The offset of s is the offset of s without its lowest set bit, plus the bit of the qubit that bit stands for (so wide bijections take O(2^m) here, not O(m 2^m)).
+    std::vector<StateIndex> offsets(1 << m, 0);
+    for(int s = 1; s < (1 << m); s++){
+        offsets[s] = offsets[s & (s - 1)] | bits[__builtin_ctz(s)];
+    }
+    return offsets;
+}
+
+// Returns the bits holding the given qubits in increasing order.
+std::vector<int> sortedBitPositions(const std::vector<int>& qubits, int numQubits){
+    std::vector<int> positions;
+    for(int qubit : qubits){
+        positions.push_back(qubitBitPosition(qubit, numQubits));
+    }
+    std::sort(positions.begin(), positions.end());
+    return positions;
+}
+
+// Adds the bits set in controlMask to a list of bit positions in increasing order (the result is in increasing order as well).
+std::vector<int> addControlPositions(const std::vector<int>& sortedPositions, StateIndex controlMask){
+    std::vector<int> positions = sortedPositions;
+    for(int position = 0; position < MAX_QUBITS; position++){
+        if((controlMask >> position) & 1){
+            positions.push_back(position);
+        }
+    }
+    std::sort(positions.begin(), positions.end());
+    return positions;
+}
+
+// Returns the bits holding the given qubits, in the same order as the qubits.
+std::vector<int> bitPositions(const std::vector<int>& qubits, int numQubits){
+    std::vector<int> positions;
+    for(int qubit : qubits){
+        positions.push_back(qubitBitPosition(qubit, numQubits));
+    }
+    return positions;
+}
+
+/*
+Moves every state of a sparse superposition to a new state. remap(s) returns the new value for the m qubits
+(given their old value s) along with a phase to multiply the coefficient by. remap must be a bijection.
+States that controls does not select are left where they are.
+The moved states are written into spare (which keeps its memory from earlier gates), and the two maps are then swapped.
+*/
+template <typename Remap>
+void remapStates(AmplitudeMap& superposition, AmplitudeMap& spare, const std::vector<int>& qubits, int numQubits, Remap remap,
+                 const ControlBits& controls){
+    QubitGather gather(qubits, numQubits);
+    StateIndex qubitMask = gather.getMask();
+
+    spare.clear();
+    spare.reserve(superposition.size());
+    for(const auto& entry : superposition){
+        StateIndex state = entry.first;
+        if((state & controls.mask) != controls.value){
+            spare.insertNew(state, entry.second);
+            continue;
+        }
+        std::pair<StateIndex, std::complex<double>> image = remap(gather.extract(state));
+        spare.insertNew((state & ~qubitMask) | gather.deposit(image.first), entry.second * image.second);
+    }
+    superposition.swap(spare);
+}
+
+// Orders the entries of a sorted register by state.
+bool stateLess(const AmplitudeMap::Entry& a, const AmplitudeMap::Entry& b){
+    return a.first < b.first;
+}
+
+// The sorted version of remapStates. The moved states are written into spare, which is then sorted and swapped in.
+template <typename Remap>
+void remapStates(std::vector<AmplitudeMap::Entry>& states, std::vector<AmplitudeMap::Entry>& spare, const std::vector<int>& qubits, int numQubits, Remap remap,
+                 const ControlBits& controls){
+    QubitGather gather(qubits, numQubits);
+    StateIndex qubitMask = gather.getMask();
+
+    spare.clear();
+    for(const auto& entry : states){
+        StateIndex state = entry.first;
+        if((state & controls.mask) != controls.value){
+            spare.push_back(entry);
+            continue;
+        }
+        std::pair<StateIndex, std::complex<double>> image = remap(gather.extract(state));
+        spare.push_back({(state & ~qubitMask) | gather.deposit(image.first), entry.second * image.second});
+    }
+    std::sort(spare.begin(), spare.end(), stateLess);
+    states.swap(spare);
+}
+
+/*
+Picks one state of a sparse or sorted register, where each state is picked with probability equal to the norm of its coefficient.
+We walk through the states adding up their probabilities until the sum passes rand, so on average only half of the states are read.
+If rounding keeps the sum below rand, the last state is picked.
+*/
+template <typename States>
+StateIndex sampleState(const States& states, double rand){
+    StateIndex state = 0;
+    double sum = 0;
+    for(const auto& entry : states){
+        state = entry.first;
+        sum += std::norm(entry.second);
+        if(sum > rand){
+            break;
+        }
+    }
+    return state;
+}
+
+// The same as normKernel and scaleKernel, except that short runs are handled here directly (calling a kernel costs more than the work itself).
+double runNorm(const std::complex<double>* x, long long length){
+    if(length == 1){
+        return std::norm(x[0]);
+    }
+    if(length >= 8){
+        return normKernel(x, length);
+    }
+    double sum = 0;
+    for(long long k = 0; k < length; k++){
+        sum += std::norm(x[k]);
+    }
+    return sum;
+}
+
+void scaleRun(std::complex<double>* x, long long length, double scale){
+    if(length == 1){
+        x[0] *= scale;
+    }
+    else if(length >= 8){
+        scaleKernel(x, length, scale);
+    }
+    else{
+        for(long long k = 0; k < length; k++){
+            x[k] *= scale;
+        }
+    }
+}
+
+/*
+Applies count butterflies of a radix-2 FFT, where butterfly j combines the rows x + j * rowLength and y + j * rowLength (rowLength amplitudes each)
+with the twiddle w[j]: the first row becomes (x + w[j] y) / sqrt(2) and the second (x - w[j] y) / sqrt(2). With the 1 / sqrt(2), each butterfly is
+a unitary 2x2 gate, so every stage of the FFT keeps the state normalized. Long rows go through the pair kernel, and short ones multiply through
+real() and imag() by hand (like the kernels, this avoids the checks of std::complex multiplication).
+*/
+void butterflyRows(std::complex<double>* x, std::complex<double>* y, long long count, long long rowLength, const std::complex<double>* w){
+    const double s = 1 / std::sqrt(2.0);
+    if(rowLength >= 8){
+        for(long long j = 0; j < count; j++){
+            const std::complex<double> u[2][2] = {{s, s * w[j]}, {s, -s * w[j]}};
+            applyPairKernel(x + j * rowLength, rowLength, y - x, u);
+        }
+        return;
+    }
+    for(long long j = 0; j < count; j++){
+        double wr = s * w[j].real(), wi = s * w[j].imag();
+        std::complex<double>* a = x + j * rowLength;
+        std::complex<double>* b = y + j * rowLength;
+        for(long long k = 0; k < rowLength; k++){
+            double tr = wr * b[k].real() - wi * b[k].imag();
+            double ti = wr * b[k].imag() + wi * b[k].real();
+            double ar = s * a[k].real(), ai = s * a[k].imag();
+            a[k] = std::complex<double>(ar + tr, ai + ti);
+            b[k] = std::complex<double>(ar - tr, ai - ti);
+        }
+    }
+}
+
+/*
+Runs the stages of a radix-2 FFT (decimation in time) on numSlices consecutive matrices of 2^m rows, each 2^rowBits amplitudes long. Every column of
+every matrix is transformed on its own, so that column x becomes sum(k) exp(2 pi i j k / 2^m) x[k] / sqrt(2^m) in row j (with exp(-2 pi i j k / 2^m)
+for the inverse). The rows of each matrix must be given with the bits of their numbers reversed (row j holds x[reverseBits(j, m)]).
+*/
+void fourierStages(std::complex<double>* amp, long long numSlices, int m, int rowBits, bool inverse, ThreadPool& pool){
+    long long numRows = 1LL << m;
+    long long rowLength = 1LL << rowBits;
+
+    /*
+    Every twiddle is a power of exp(i pi / lastHalf) (or of exp(-i pi / lastHalf) for the inverse), and twiddle(J) = exp(+-i pi J / lastHalf) is found as
+    coarse[J >> fineBits] * fine[J & (fine.size() - 1)]. The two tables only hold about 2 sqrt(2^m) values, where a table of every twiddle of the
+    last stage would take as much memory as the amplitudes when the whole register is transformed.
+    */
+    double sign = inverse ? -1 : 1;
+    long long lastHalf = numRows / 2;
+    int fineBits = m / 2;
+    Vector fine(1LL << fineBits), coarse(std::max(1LL, lastHalf >> fineBits));
+    for(long long j = 0; j < (long long)fine.size(); j++){
+        fine[j] = std::polar(1.0, sign * PI * j / lastHalf);
+    }
+    for(long long j = 0; j < (long long)coarse.size(); j++){
+        coarse[j] = std::polar(1.0, sign * PI * (j << fineBits) / lastHalf);
+    }
+    auto twiddle = [&](long long J){
+        return coarse[J >> fineBits] * fine[J & (fine.size() - 1)];
+    };
+
+    /*
+    Stage s combines the rows j and j + 2^(s-1) in each group of 2^s rows, with the twiddle of j within its group. The first stages only mix rows within
+    small groups, so they are run on one block of blockRows rows at a time while the block stays in cache.
+    */
+    int blockStages = std::max(0, std::min(m, FOURIER_BLOCK_QUBITS - rowBits));
+    long long blockRows = 1LL << blockStages;
+
+    // The stage that combines rows half apart uses the twiddles exp(+-i pi j / half), which are stored in blockTwiddles[half + j] for the block stages.
+    Vector blockTwiddles(blockRows);
+    for(long long half = 1; half < blockRows; half *= 2){
+        for(long long j = 0; j < half; j++){
+            blockTwiddles[half + j] = twiddle(j * (lastHalf / half));
+        }
+    }
+    pool.parallelFor(numSlices * numRows / blockRows, [&](long long from, long long to){
+        for(long long block = from; block < to; block++){
+            std::complex<double>* x = amp + block * blockRows * rowLength;
+            for(int s = 1; s <= blockStages; s++){
+                long long half = 1LL << (s - 1);
+                for(long long group = 0; group < blockRows; group += 2 * half){
+                    std::complex<double>* first = x + group * rowLength;
+                    butterflyRows(first, first + half * rowLength, half, rowLength, &blockTwiddles[half]);
+                }
+            }
+        }
+    }, 1);
+
+    /*
+    The remaining stages each take a full pass, split over every butterfly (numRows / 2 in each slice). Their twiddles are worked out for up to
+    FOURIER_TWIDDLE_CHUNK butterflies at a time, which stays in cache while they are used.
+    */
+    for(int s = blockStages + 1; s <= m; s++){
+        long long half = 1LL << (s - 1);
+        pool.parallelFor(numSlices * numRows / 2, [&](long long from, long long to){
+            Vector stageTwiddles(FOURIER_TWIDDLE_CHUNK);
+            for(long long butterfly = from; butterfly < to; ){
+                // Stop at the end of a group of butterflies (they share the twiddles of j = 0 to half - 1) or of the chunk.
+                long long j = butterfly & (half - 1);
+                long long count = std::min({half - j, to - butterfly, FOURIER_TWIDDLE_CHUNK});
+                for(long long t = 0; t < count; t++){
+                    stageTwiddles[t] = twiddle((j + t) * (lastHalf / half));
+                }
+                std::complex<double>* first = amp + (((butterfly >> (s - 1)) << s) | j) * rowLength;
+                butterflyRows(first, first + half * rowLength, count, rowLength, stageTwiddles.data());
+                butterfly += count;
+            }
+        }, std::max(1LL, (1LL << 12) / rowLength));
+    }
+}
+
+// Reverses the order of the lowest numBits bits of value.
+StateIndex reverseBits(StateIndex value, int numBits){
+    StateIndex reversed = 0;
+    for(int k = 0; k < numBits; k++){
+        reversed = (reversed << 1) | ((value >> k) & 1);
+    }
+    return reversed;
+}
+
+/*
+Inserts a 0 bit at each of the given (increasing) bit positions of i.
+As i runs from 0 to 2^(n-m) - 1, this enumerates every state where all m of the qubits at those positions are 0.
+*/
+StateIndex insertZeroBits(StateIndex i, const std::vector<int>& sortedPositions){
+    for(int position : sortedPositions){
+        StateIndex low = i & ((StateIndex(1) << position) - 1);
+        i = ((i >> position) << (position + 1)) | low;
+    }
+    return i;
+}
+
+// Returns the smallest value in each cycle of a permutation of 0 to size - 1 (fixed points included).
+std::vector<int> permutationCycles(const int* permutation, int size){
+    std::vector<int> cycles;
+    std::vector<bool> visited(size, false);
+    for(int s = 0; s < size; s++){
+        if(visited[s]){
+            continue;
+        }
+        cycles.push_back(s);
+        for(int t = s; !visited[t]; t = permutation[t]){
+            visited[t] = true;
+        }
+    }
+    return cycles;
+}
+
+/*
+Applies a permutation gate to one run of a dense register (see forEachDenseRun): the length states starting at base | offsets[s] move to
+base | offsets[permutation[s]] and are multiplied by phases[s]. cycles must come from permutationCycles, and buffer must have room for length amplitudes.
+We carry one run around each cycle in the buffer, so whole runs are moved at a time.
+*/
+void permuteRun(std::complex<double>* amp, long long base, long long length, const std::vector<StateIndex>& offsets, const int* permutation,
+                const std::complex<double>* phases, const std::vector<int>& cycles, std::complex<double>* buffer){
+    for(int start : cycles){
+        if(permutation[start] == start){
+            if(phases[start] != 1.0){
+                scaleKernel(amp + (base | offsets[start]), length, phases[start]);
+            }
+            continue;
+        }
+        std::copy(amp + (base | offsets[start]), amp + (base | offsets[start]) + length, buffer);
+        int s = start;
+        do{
+            int next = permutation[s];
+            if(phases[s] != 1.0){
+                scaleKernel(buffer, length, phases[s]);
+            }
+            std::swap_ranges(buffer, buffer + length, amp + (base | offsets[next]));
+            s = next;
+        } while(s != start);
+    }
+}
+
+/*
+A unitary prepared for applyUnitariesBlocked, sorted into the same cases that applyUnitary uses for a whole register:
+SCALE multiplies some of the values of the qubits by a phase (diagonal gates), PAIR applies a 2x2 gate to pairs of states (single-qubit
+and controlled single-qubit gates), PERMUTE moves states around (permutation gates) and MATRIX multiplies by the full matrix.
+TABLE multiplies every state of the block by its own phase, which is how several diagonal gates in a row are applied at once.
+*/
+struct BlockGate{
+    enum Kind {
+        SCALE, PAIR, PERMUTE, MATRIX, TABLE
+    };
+    Kind kind;
+    std::vector<int> positions;
+    std::vector<StateIndex> offsets;
+
+    // SCALE: the offset of every value of the qubits whose phase is not 1, along with the phase.
+    std::vector<std::pair<StateIndex, std::complex<double>>> scales;
+
+    // PAIR: the gate is applied to the pairs (base | pairOffset, base | pairOffset | pairStride).
+    std::complex<double> pair[2][2];
+    StateIndex pairOffset = 0;
+    StateIndex pairStride = 0;
+
+    // PERMUTE: value s of the qubits is sent to permutation[s] and multiplied by phases[s] (see permuteRun).
+    std::vector<int> permutation;
+    Vector phases;
+    std::vector<int> cycles;
+
+    // MATRIX: a row-major copy of the unitary.
+    Vector matrix;
+
+    // TABLE: the phase of every state in a block.
+    Vector table;
+};
+
+BlockGate makeBlockGate(const Unitary& u, const std::vector<int>& qubits, int numQubits){
+    BlockGate gate;
+    gate.positions = sortedBitPositions(qubits, numQubits);
+    gate.offsets = subStateOffsets(qubits, numQubits);
+    int size = u.size();
+
+    if(u.getStructure() == DIAGONAL){
+        gate.kind = BlockGate::SCALE;
+        for(int s = 0; s < size; s++){
+            if(u.getPhases()[s] != 1.0){
+                gate.scales.push_back({gate.offsets[s], u.getPhases()[s]});
+            }
+        }
+    }
+    else if(size == 2 || (size == 4 && u[0][0] == 1.0 && u[0][1] == 0.0 && u[1][0] == 0.0 && u[1][1] == 1.0)){
+        // A single-qubit gate, or a controlled single-qubit gate where only the pairs with the control set to 1 change.
+        gate.kind = BlockGate::PAIR;
+        int corner = size - 2;
+        for(int r = 0; r < 2; r++){
+            for(int c = 0; c < 2; c++){
+                gate.pair[r][c] = u[corner + r][corner + c];
+            }
+        }
+        gate.pairOffset = gate.offsets[corner];
+        gate.pairStride = gate.offsets[corner + 1] ^ gate.offsets[corner];
+    }
+    else if(u.getStructure() == PERMUTATION){
+        gate.kind = BlockGate::PERMUTE;
+        gate.permutation = u.getPermutation();
+        gate.phases = u.getPhases();
+        gate.cycles = permutationCycles(gate.permutation.data(), size);
+    }
+    else{
+        gate.kind = BlockGate::MATRIX;
+        gate.matrix.assign(u.data(), u.data() + size * size);
+    }
+    return gate;
+}
+
+// Applies a gate to the blockSize amplitudes starting at amp. scratch must have room for 4 * 2^m amplitudes, and for blockSize / 2 amplitudes.
+void applyBlockGate(const BlockGate& gate, std::complex<double>* amp, long long blockSize, std::complex<double>* scratch){
+    if(gate.kind == BlockGate::TABLE){
+        multiplyKernel(amp, gate.table.data(), blockSize);
+        return;
+    }
+    if(gate.kind == BlockGate::PAIR && gate.pairOffset == 0 && gate.pairStride == 1){
+        applyAdjacentPairKernel(amp, blockSize / 2, gate.pair);
+        return;
+    }
+
+    int subSize = gate.offsets.size();
+    long long runLength = 1LL << gate.positions[0];
+    long long numRuns = (blockSize / subSize) / runLength;
+    for(long long run = 0; run < numRuns; run++){
+        long long base = insertZeroBits(run * runLength, gate.positions);
+        switch(gate.kind){
+            case BlockGate::SCALE:
+                for(const auto& scale : gate.scales){
+                    scaleKernel(amp + (base | scale.first), runLength, scale.second);
+                }
+                break;
+            case BlockGate::PAIR:
+                applyPairKernel(amp + (base | gate.pairOffset), runLength, gate.pairStride, gate.pair);
+                break;
+            case BlockGate::PERMUTE:
+                permuteRun(amp, base, runLength, gate.offsets, gate.permutation.data(), gate.phases.data(), gate.cycles, scratch);
+                break;
+            case BlockGate::MATRIX:
+                applyMatrixKernel(amp + base, runLength, gate.offsets.data(), subSize, gate.matrix.data(), scratch);
+                break;
+            case BlockGate::TABLE:
+                break;
+        }
+    }
+}
+
+QuantumRegister::QuantumRegister(int _qubits): numQubits(_qubits), representation(SPARSE) {
+    assert(numQubits <= MAX_QUBITS);
+    superposition[0] = 1;
+}
+
+QuantumRegister::QuantumRegister(int _qubits, Representation _representation): numQubits(_qubits), representation(SPARSE) {
+    assert(numQubits <= MAX_QUBITS);
+    superposition[0] = 1;
+    adaptivePolicy.enabled = false;
+    setRepresentation(_representation);
+}
+
+QuantumRegister::QuantumRegister(int _qubits, std::unordered_map<StateIndex, std::complex<double>> _superposition): numQubits(_qubits), representation(SPARSE) {
+    assert(numQubits <= MAX_QUBITS);
+    superposition.reserve(_superposition.size());
+    for(const auto& entry : _superposition){
+        superposition[entry.first] = entry.second;
+    }
+}
+
+Representation QuantumRegister::getRepresentation() const {
+    return representation;
+}
+
+void QuantumRegister::setRepresentation(Representation newRepresentation){
+    if(newRepresentation == representation){
+        return;
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    // The states a dense register drops (for being below the pruning threshold) when it becomes sparse.
+    long long droppedStates = 0;
+    double droppedProbability = 0;
+
+    if(newRepresentation == DENSE){
+        assert(numQubits <= MAX_DENSE_QUBITS);
+
+        amplitudes.assign((size_t)1 << numQubits, 0);
+        for(const auto& entry : superposition){
+            amplitudes[entry.first] = entry.second;
+        }
+        for(const auto& entry : sortedStates){
+            amplitudes[entry.first] = entry.second;
+        }
+    }
+    else if(representation == DENSE){
+        superposition.clear();
+        sortedStates.clear();
+        for(StateIndex state = 0; state < amplitudes.size(); state++){
+            double probability = std::norm(amplitudes[state]);
+            if(probability >= pruningPolicy.threshold){
+                if(newRepresentation == SPARSE){
+                    superposition.insertNew(state, amplitudes[state]);
+                }
+                else{
+                    sortedStates.push_back({state, amplitudes[state]});
+                }
+            }
+            else if(probability > 0){
+                droppedStates++;
+                droppedProbability += probability;
+            }
+        }
+    }
+    else if(newRepresentation == SORTED){
+        sortedStates.clear();
+        sortedStates.reserve(superposition.size());
+        for(const auto& entry : superposition){
+            sortedStates.push_back(entry);
+        }
+        std::sort(sortedStates.begin(), sortedStates.end(), stateLess);
+    }
+    else{
+        superposition.clear();
+        superposition.reserve(sortedStates.size());
+        for(const auto& entry : sortedStates){
+            superposition.insertNew(entry.first, entry.second);
+        }
+    }
+
+    // Release the memory held by the representations we are no longer using.
+    if(newRepresentation != SPARSE){
+        AmplitudeMap().swap(superposition);
+        AmplitudeMap().swap(spareSuperposition);
+    }
+    if(newRepresentation != SORTED){
+        std::vector<AmplitudeMap::Entry>().swap(sortedStates);
+        std::vector<AmplitudeMap::Entry>().swap(spareSortedStates);
+    }
+    if(newRepresentation != DENSE){
+        AmplitudeVector().swap(amplitudes);
+    }
+
+    if(newRepresentation == DENSE){
+        stats.sparseToDenseConversions++;
+    }
+    else if(representation == DENSE){
+        stats.denseToSparseConversions++;
+    }
+    bool wasDense = representation == DENSE;
+    representation = newRepresentation;
+    if(wasDense){
+        prune(droppedStates, droppedProbability);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    stats.conversionSeconds += elapsed.count();
+}
+
+const AdaptivePolicy& QuantumRegister::getAdaptivePolicy() const {
+    return adaptivePolicy;
+}
+
+void QuantumRegister::setAdaptivePolicy(const AdaptivePolicy& policy){
+    adaptivePolicy = policy;
+    if(adaptivePolicy.enabled && representation != DENSE){
+        setRepresentation(adaptivePolicy.sparseRepresentation);
+    }
+    updateRepresentation(true);
+}
+
+const RepresentationStats& QuantumRegister::getStats() const {
+    return stats;
+}
+
+const PruningPolicy& QuantumRegister::getPruningPolicy() const {
+    return pruningPolicy;
+}
+
+void QuantumRegister::setPruningPolicy(const PruningPolicy& policy){
+    pruningPolicy = policy;
+    if(representation != DENSE){
+        prune(0, 0, true);
+    }
+}
+
+const PruningStats& QuantumRegister::getPruningStats() const {
+    return pruningStats;
+}
+
+void QuantumRegister::prune(long long droppedStates, double droppedProbability, bool checkThreshold){
+    size_t numStates = representation == SORTED ? sortedStates.size() : superposition.size();
+    size_t maxStates = pruningPolicy.maxStates > 0 ? std::min<size_t>(numStates, pruningPolicy.maxStates) : numStates;
+
+    /*
+    The stored states add up to norm, and stand for the 1 - prunedProbability of the original state that is left, so each unit of stored probability
+    is toOriginal of the original state. Without renormalizing this is 1, but once the states are scaled back up, a drop of p only loses p * toOriginal.
+    The stats and the budget are kept in units of the original state, so the truncation error never goes above 1.
+    */
+    double toOriginal = norm > 0 ? (1 - pruningStats.prunedProbability) / norm : 0;
+    double unspent = pruningPolicy.maxPrunedProbability - pruningStats.prunedProbability;
+    double budget = toOriginal > 0 ? unspent / toOriginal - droppedProbability : 0;
+
+    if(checkThreshold || numStates > maxStates || budget > 0){
+        /*
+        The probability and position (index in the sorted array, or slot in the map) of every state we might drop.
+        States below the threshold have to go, and so do the least likely states over the limit, but the rest only go while they fit in the budget.
+        */
+        std::vector<std::pair<double, size_t>> candidates;
+        size_t numBelowThreshold = 0;
+        auto consider = [&](double probability, size_t position){
+            bool belowThreshold = checkThreshold && probability < pruningPolicy.threshold;
+            numBelowThreshold += belowThreshold;
+            if(belowThreshold || numStates > maxStates || probability <= budget){
+                candidates.push_back({probability, position});
+            }
+        };
+        if(representation == SORTED){
+            for(size_t k = 0; k < numStates; k++){
+                consider(std::norm(sortedStates[k].second), k);
+            }
+        }
+        else{
+            for(size_t slot = 0; slot < superposition.numSlots(); slot++){
+                if(superposition.isOccupied(slot)){
+                    consider(std::norm(superposition.entryAt(slot).second), slot);
+                }
+            }
+        }
+
+        // The states below the threshold are also the least likely, so they count towards the states over the limit.
+        size_t numDropped = std::max(numBelowThreshold, numStates - maxStates);
+        std::nth_element(candidates.begin(), candidates.begin() + numDropped, candidates.end());
+        for(size_t k = 0; k < numDropped; k++){
+            droppedProbability += candidates[k].first;
+            // States that cancelled out completely were never really there, so they are not counted.
+            droppedStates += candidates[k].first > 0;
+        }
+        budget = toOriginal > 0 ? unspent / toOriginal - droppedProbability : 0;
+        auto affordable = std::partition(candidates.begin() + numDropped, candidates.end(), [budget](const std::pair<double, size_t>& candidate){
+            return candidate.first <= budget;
+        });
+        std::sort(candidates.begin() + numDropped, affordable);
+        for(; candidates.begin() + numDropped < affordable && candidates[numDropped].first <= budget; numDropped++){
+            budget -= candidates[numDropped].first;
+            droppedProbability += candidates[numDropped].first;
+            droppedStates += candidates[numDropped].first > 0;
+        }
+
+        if(representation == SORTED){
+            std::vector<bool> dropped(numStates, false);
+            for(size_t k = 0; k < numDropped; k++){
+                dropped[candidates[k].second] = true;
+            }
+            size_t numKept = 0;
+            for(size_t k = 0; k < numStates; k++){
+                if(!dropped[k]){
+                    sortedStates[numKept++] = sortedStates[k];
+                }
+            }
+            sortedStates.resize(numKept);
+        }
+        else{
+            // Erasing an entry moves the entries after it, so we find all of the states before erasing any of them.
+            std::vector<StateIndex> dropped;
+            for(size_t k = 0; k < numDropped; k++){
+                dropped.push_back(superposition.entryAt(candidates[k].second).first);
+            }
+            for(StateIndex state : dropped){
+                superposition.erase(state);
+            }
+        }
+    }
+
+    // Pruning, or a gate that cancels out most of the states (e.g. Hadamard gates undoing each other), can leave the map far emptier than its slots.
+    if(representation == SPARSE){
+        shrinkSparseMaps();
+    }
+
+    pruningStats.prunedStates += droppedStates;
+    pruningStats.prunedProbability += droppedProbability * toOriginal;
+    norm -= droppedProbability;
+    if(pruningPolicy.renormalize && droppedProbability > 0 && norm > 0){
+        double scale = 1/sqrt(norm);
+        forEachSparseState([scale](AmplitudeMap::Entry& entry){
+            entry.second *= scale;
+        });
+        norm = 1;
+    }
+}
+
+void QuantumRegister::shrinkSparseMaps(){
+    /*
+    The spare map holds the slots of the larger superposition from before, and would be swapped back in by the next gate,
+    so it is released as well. It is cleared before every use anyway, and the next gate sizes it to the smaller superposition.
+    */
+    if(superposition.shrinkToFit()){
+        AmplitudeMap().swap(spareSuperposition);
+    }
+}
+
+double QuantumRegister::fillRatio(){
+    return (double)numStates() / std::ldexp(1.0, numQubits);
+}
+
+void QuantumRegister::updateRepresentation(bool afterMeasurement){
+    if(!adaptivePolicy.enabled){
+        return;
+    }
+
+    if(representation != DENSE){
+        if(numQubits <= std::min(adaptivePolicy.maxDenseQubits, MAX_DENSE_QUBITS) && fillRatio() >= adaptivePolicy.denseThreshold){
+            setRepresentation(DENSE);
+        }
+    }
+    else{
+        if(numQubits > adaptivePolicy.maxDenseQubits || (afterMeasurement && fillRatio() <= adaptivePolicy.sparseThreshold)){
+            setRepresentation(adaptivePolicy.sparseRepresentation);
+        }
+    }
+}
+
+int QuantumRegister::getNumQubits() const {
+    return numQubits;
+}
+
+int QuantumRegister::numStates(){
+    if(representation == DENSE){
+        int count = 0;
+        for(const std::complex<double>& coeff : amplitudes){
+            if(std::norm(coeff) >= pruningPolicy.threshold){
+                count++;
+            }
+        }
+        return count;
+    }
+    if(representation == SORTED){
+        return sortedStates.size();
+    }
+    return superposition.size();
+}
+
+std::complex<double> QuantumRegister::getCoefficient(StateIndex state) const {
+    if(representation == DENSE){
+        return amplitudes[state];
+    }
+    if(representation == SORTED){
+        auto iterator = std::lower_bound(sortedStates.begin(), sortedStates.end(), AmplitudeMap::Entry{state, 0}, stateLess);
+        return iterator != sortedStates.end() && iterator->first == state ? iterator->second : 0;
+    }
+
+    const std::complex<double>* coeff = superposition.find(state);
+    if(coeff){
+        return *coeff;
+    }
+    else{
+        return 0;
+    }
+}
+
+std::vector<AmplitudeMap::Entry> QuantumRegister::getStates() const {
+    if(representation == SORTED){
+        return sortedStates;
+    }
+
+    std::vector<AmplitudeMap::Entry> states;
+    if(representation == DENSE){
+        for(StateIndex state = 0; state < amplitudes.size(); state++){
+            if(std::norm(amplitudes[state]) >= pruningPolicy.threshold){
+                states.push_back({state, amplitudes[state]});
+            }
+        }
+        return states;
+    }
+    states.reserve(superposition.size());
+    for(const auto& entry : superposition){
+        states.push_back(entry);
+    }
+    std::sort(states.begin(), states.end(), stateLess);
+    return states;
+}
+
+double QuantumRegister::probability(StateIndex state) const {
+    return std::norm(getCoefficient(state));
+}
+
+BasisState QuantumRegister::measure(const std::vector<int>& qubitsToMeasure){
+    for(int i : qubitsToMeasure){
+        // Make sure that we are not re-measuring a qubit.
+        assert(measuredQubits.find(i) == measuredQubits.end());
+        
+        measuredQubits.insert(i);
+    }
+
+    if(representation == DENSE){
+        BasisState output = measureDense(qubitsToMeasure);
+        norm = 1;
+        updateRepresentation(true);
+        return output;
+    }
+
+    /*
+    Measuring some of the qubits gives each outcome with the same probability as picking a single state (with probability equal to its norm)
+    and reading off its measured qubits. So we pick a state, and then keep only the states that agree with it on the measured qubits.
+    */
+    QubitGather gather(qubitsToMeasure, this->numQubits);
+    StateIndex measuredMask = gather.getMask();
+    double rand = generateRandomDouble() * norm;
+    StateIndex outcome = (representation == SORTED ? sampleState(sortedStates, rand) : sampleState(superposition, rand)) & measuredMask;
+
+    double keptProbability = 0;
+    if(representation == SORTED){
+        // The states we keep stay in order, so we can pack them to the front of the array in place.
+        size_t numKept = 0;
+        for(const auto& entry : sortedStates){
+            if((entry.first & measuredMask) == outcome){
+                keptProbability += std::norm(entry.second);
+                sortedStates[numKept++] = entry;
+            }
+        }
+        sortedStates.resize(numKept);
+    }
+    else{
+        spareSuperposition.clear();
+        for(const auto& entry : superposition){
+            if((entry.first & measuredMask) == outcome){
+                keptProbability += std::norm(entry.second);
+                spareSuperposition.insertNew(entry.first, entry.second);
+            }
+        }
+        superposition.swap(spareSuperposition);
+        shrinkSparseMaps();
+    }
+
+    // Scale up the coefficients so that the probabilities sum to 1.
+    double scale = 1/sqrt(keptProbability);
+    forEachSparseState([scale](AmplitudeMap::Entry& entry){
+        entry.second *= scale;
+    });
+    norm = 1;
+
+    updateRepresentation(true);
+    return BasisState(gather.extract(outcome), qubitsToMeasure.size());
+}
+
+std::vector<BasisState> QuantumRegister::measureEach(const std::vector<int>& qubitsToMeasure, const std::vector<int>& groupQubits){
+    for(int i : qubitsToMeasure){
+        // Make sure that we are not re-measuring a qubit, or measuring one of the qubits that tell the groups apart.
+        assert(measuredQubits.find(i) == measuredQubits.end());
+        assert(std::find(groupQubits.begin(), groupQubits.end(), i) == groupQubits.end());
+        measuredQubits.insert(i);
+    }
+
+    QubitGather measureGather(qubitsToMeasure, this->numQubits);
+    QubitGather groupGather(groupQubits, this->numQubits);
+    StateIndex measuredMask = measureGather.getMask();
+    size_t numGroups = size_t(1) << groupQubits.size();
+
+    /*
+    As in measure, each group picks one of its states (with probability equal to its norm) and keeps the states that agree with it on the measured qubits.
+    The first pass adds up the probability of each group, and the second walks through the states until each group has passed its random target.
+    */
+    std::vector<double> groupProbabilities(numGroups, 0);
+    forEachStoredState([&](StateIndex state, std::complex<double>& coeff){
+        groupProbabilities[groupGather.extract(state)] += std::norm(coeff);
+    });
+    std::vector<double> targets(numGroups);
+    for(size_t g = 0; g < numGroups; g++){
+        targets[g] = generateRandomDouble() * groupProbabilities[g];
+    }
+    std::vector<StateIndex> outcomes(numGroups, 0);
+    std::vector<bool> chosen(numGroups, false);
+    forEachStoredState([&](StateIndex state, std::complex<double>& coeff){
+        StateIndex g = groupGather.extract(state);
+        if(chosen[g]){
+            return;
+        }
+        // If rounding keeps the sum below the target, the last state of the group is picked.
+        outcomes[g] = state & measuredMask;
+        double probability = std::norm(coeff);
+        if(targets[g] < probability){
+            chosen[g] = true;
+        }
+        targets[g] -= probability;
+    });
+
+    // Remove every state that disagrees with the outcome of its group, and scale up the rest so that each group keeps its probability.
+    std::vector<double> keptProbabilities(numGroups, 0);
+    forEachStoredState([&](StateIndex state, std::complex<double>& coeff){
+        StateIndex g = groupGather.extract(state);
+        if((state & measuredMask) == outcomes[g]){
+            keptProbabilities[g] += std::norm(coeff);
+        }
+        else{
+            coeff = 0;
+        }
+    });
+    std::vector<double> scales(numGroups, 0);
+    for(size_t g = 0; g < numGroups; g++){
+        if(keptProbabilities[g] > 0){
+            scales[g] = sqrt(groupProbabilities[g] / keptProbabilities[g]);
+        }
+    }
+    forEachStoredState([&](StateIndex state, std::complex<double>& coeff){
+        coeff *= scales[groupGather.extract(state)];
+    });
+
+    // A sparse (or sorted) register drops the states that were set to 0 above.
+    if(representation == SORTED){
+        sortedStates.erase(std::remove_if(sortedStates.begin(), sortedStates.end(), [](const AmplitudeMap::Entry& entry){
+            return entry.second == 0.0;
+        }), sortedStates.end());
+    }
+    else if(representation == SPARSE){
+        spareSuperposition.clear();
+        for(const auto& entry : superposition){
+            if(entry.second != 0.0){
+                spareSuperposition.insertNew(entry.first, entry.second);
+            }
+        }
+        superposition.swap(spareSuperposition);
+        shrinkSparseMaps();
+    }
+
+    updateRepresentation(true);
+
+    std::vector<BasisState> results;
+    for(size_t g = 0; g < numGroups; g++){
+        results.push_back(BasisState(measureGather.extract(outcomes[g]), qubitsToMeasure.size()));
+    }
+    return results;
+}
+
+std::vector<double> QuantumRegister::outcomeProbabilitiesDense(const std::vector<int>& qubits){
+    /*
+    Outcome s has probability equal to the total probability of every state whose measured qubits equal s.
+    For each run of states where the measured qubits are all 0, we go through the matching runs of every outcome.
+    Measuring the qubit in the lowest bit makes every run a single state, so that case skips the loop over the run.
+    */
+    int numOutcomes = 1 << qubits.size();
+    std::vector<int> positions = sortedBitPositions(qubits, this->numQubits);
+    std::vector<StateIndex> offsets = subStateOffsets(qubits, this->numQubits);
+    const std::complex<double>* amp = amplitudes.data();
+    long long runLength = 1LL << positions[0];
+    long long numRuns = ((long long)amplitudes.size() >> qubits.size()) / runLength;
+    long long numParts = std::min(MEASURE_PARTS, numRuns);
+    std::vector<double> partProbabilities(numParts * numOutcomes, 0);
+    threadPool().parallelFor(numParts, [&](long long begin, long long end){
+        for(long long part = begin; part < end; part++){
+            double* sums = &partProbabilities[part * numOutcomes];
+            for(long long run = part * numRuns / numParts; run < (part + 1) * numRuns / numParts; run++){
+                StateIndex base = insertZeroBits(run * runLength, positions);
+                for(int s = 0; s < numOutcomes; s++){
+                    sums[s] += runLength == 1 ? std::norm(amp[base | offsets[s]]) : runNorm(amp + (base | offsets[s]), runLength);
+                }
+            }
+        }
+    }, 1);
+
+    std::vector<double> outcomeProbabilities(numOutcomes, 0);
+    for(long long part = 0; part < numParts; part++){
+        for(int s = 0; s < numOutcomes; s++){
+            outcomeProbabilities[s] += partProbabilities[part * numOutcomes + s];
+        }
+    }
+    return outcomeProbabilities;
+}
 
 /*
-The minimum probability we consider. 
-If some state has a probability of occuring less than this, then we set it to 0 for performance purposes.
+Draws shots outcomes from a distribution given by the outcomes that can happen and the cumulative sums of their probabilities, and returns how many times each came up.
+Each shot is a binary search through the cumulative distribution. Scaling by the total keeps rounding errors from skewing the last outcome.
 */
-const double MIN_PROBABILITY = 1e-20;
+std::map<StateIndex, int> drawShots(const std::vector<StateIndex>& outcomes, const std::vector<double>& cumulative, int shots){
+    std::map<StateIndex, int> histogram;
+    for(int shot = 0; shot < shots; shot++){
+        double target = generateRandomDouble() * cumulative.back();
+        size_t k = std::upper_bound(cumulative.begin(), cumulative.end(), target) - cumulative.begin();
+        histogram[outcomes[std::min(k, outcomes.size() - 1)]]++;
+    }
+    return histogram;
+}
+
+std::map<StateIndex, int> QuantumRegister::sample(const std::vector<int>& qubitsToSample, int shots){
+    int sampleSize = qubitsToSample.size();
+    QubitGather gather(qubitsToSample, this->numQubits);
+
+    // The outcomes that can happen (in increasing order), and the cumulative distribution of their probabilities.
+    std::vector<StateIndex> outcomes;
+    std::vector<double> cumulative;
+    double total = 0;
+    // Adds the probability of every state of a sparse or sorted register to the outcome given by its sampled qubits.
+    auto addStates = [&](const auto& states, auto& probabilities){
+        for(const auto& entry : states){
+            probabilities[gather.extract(entry.first)] += std::norm(entry.second);
+        }
+    };
+    auto addOutcome = [&](StateIndex outcome, double probability){
+        if(probability > 0){
+            total += probability;
+            outcomes.push_back(outcome);
+            cumulative.push_back(total);
+        }
+    };
+
+    if(sampleSize <= MAX_MEASURE_OUTCOME_QUBITS){
+        std::vector<double> probabilities;
+        if(representation == DENSE){
+            probabilities = outcomeProbabilitiesDense(qubitsToSample);
+        }
+        else{
+            probabilities.assign(1 << sampleSize, 0);
+            if(representation == SORTED){
+                addStates(sortedStates, probabilities);
+            }
+            else{
+                addStates(superposition, probabilities);
+            }
+        }
+        for(int s = 0; s < (int)probabilities.size(); s++){
+            addOutcome(s, probabilities[s]);
+        }
+    }
+    else{
+        // With too many outcomes to list, we only keep track of the ones that can happen.
+        std::unordered_map<StateIndex, double> probabilities;
+        if(representation == DENSE){
+            for(StateIndex i = 0; i < amplitudes.size(); i++){
+                if(amplitudes[i] != 0.0){
+                    probabilities[gather.extract(i)] += std::norm(amplitudes[i]);
+                }
+            }
+        }
+        else if(representation == SORTED){
+            addStates(sortedStates, probabilities);
+        }
+        else{
+            addStates(superposition, probabilities);
+        }
+        std::vector<std::pair<StateIndex, double>> sorted(probabilities.begin(), probabilities.end());
+        std::sort(sorted.begin(), sorted.end());
+        for(const auto& entry : sorted){
+            addOutcome(entry.first, entry.second);
+        }
+    }
+
+    // If no outcome is possible, this likely means that a non-unitary transformation was used somewhere in the code.
+    assert(!outcomes.empty());
+
+    return drawShots(outcomes, cumulative, shots);
+}
+
+std::vector<std::map<StateIndex, int>> QuantumRegister::sampleEach(const std::vector<int>& qubitsToSample, const std::vector<int>& groupQubits, int shots){
+    QubitGather sampleGather(qubitsToSample, this->numQubits);
+    QubitGather groupGather(groupQubits, this->numQubits);
+    size_t numGroups = size_t(1) << groupQubits.size();
+
+    // Add up the probability of each outcome in each group, in one pass over the register.
+    std::vector<std::unordered_map<StateIndex, double>> probabilities(numGroups);
+    forEachStoredState([&](StateIndex state, std::complex<double>& coeff){
+        probabilities[groupGather.extract(state)][sampleGather.extract(state)] += std::norm(coeff);
+    });
+
+    // Then sample each group from its own distribution, with the outcomes in increasing order as in sample.
+    std::vector<std::map<StateIndex, int>> histograms(numGroups);
+    for(size_t g = 0; g < numGroups; g++){
+        std::vector<std::pair<StateIndex, double>> sorted(probabilities[g].begin(), probabilities[g].end());
+        std::sort(sorted.begin(), sorted.end());
+        std::vector<StateIndex> outcomes;
+        std::vector<double> cumulative;
+        double total = 0;
+        for(const auto& entry : sorted){
+            if(entry.second > 0){
+                total += entry.second;
+                outcomes.push_back(entry.first);
+                cumulative.push_back(total);
+            }
+        }
+        if(!outcomes.empty()){
+            histograms[g] = drawShots(outcomes, cumulative, shots);
+        }
+    }
+    return histograms;
+}
+
+BasisState QuantumRegister::measureDense(const std::vector<int>& qubitsToMeasure){
+    int measureSize = qubitsToMeasure.size();
+    QubitGather gather(qubitsToMeasure, this->numQubits);
+    std::vector<int> positions = sortedBitPositions(qubitsToMeasure, this->numQubits);
+    long long size = amplitudes.size();
+    std::complex<double>* amp = amplitudes.data();
+
+    /*
+    The measured qubits only change every 2^(lowest measured bit) states, so we handle a whole run of such states at once.
+    Measuring the qubit in the lowest bit makes every run a single state, and then even looping over a run costs more than the work itself,
+    so the loops below handle that case on its own.
+    */
+    long long runLength = 1LL << positions[0];
+
+    if(measureSize <= MAX_MEASURE_OUTCOME_QUBITS){
+        std::vector<double> outcomeProbabilities = outcomeProbabilitiesDense(qubitsToMeasure);
+        int numOutcomes = outcomeProbabilities.size();
+
+        // Walk through the cumulative distribution of the outcomes.
+        double rand = generateRandomDouble() * norm;
+        double sum = 0;
+        int chosen = -1;
+        for(int s = 0; s < numOutcomes; s++){
+            if(outcomeProbabilities[s] == 0){
+                continue;
+            }
+            chosen = s;
+            sum += outcomeProbabilities[s];
+            if(sum > rand){
+                break;
+            }
+        }
+
+        // If no outcome is possible, this likely means that a non-unitary transformation was used somewhere in the code.
+        assert(chosen != -1);
+
+        // Remove every state that disagrees with the outcome, and scale up the rest so that the probabilities sum to 1.
+        std::vector<StateIndex> offsets = subStateOffsets(qubitsToMeasure, this->numQubits);
+        long long numRuns = (size >> measureSize) / runLength;
+        long long numParts = std::min(MEASURE_PARTS, numRuns);
+        double scale = 1/sqrt(outcomeProbabilities[chosen]);
+        threadPool().parallelFor(numParts, [&](long long begin, long long end){
+            for(long long part = begin; part < end; part++){
+                for(long long run = part * numRuns / numParts; run < (part + 1) * numRuns / numParts; run++){
+                    StateIndex base = insertZeroBits(run * runLength, positions);
+                    for(int s = 0; s < numOutcomes; s++){
+                        std::complex<double>* x = amp + (base | offsets[s]);
+                        if(runLength == 1){
+                            *x = (s == chosen) ? *x * scale : 0;
+                        }
+                        else if(s == chosen){
+                            scaleRun(x, runLength, scale);
+                        }
+                        else{
+                            std::fill(x, x + runLength, 0);
+                        }
+                    }
+                }
+            }
+        }, 1);
+        return BasisState(chosen, measureSize);
+    }
+
+    /*
+    With too many outcomes to count, we use the fact that the outcomes have the same probabilities as picking a single state
+    (with probability equal to its norm) and reading off its measured qubits. The probabilities of the parts form a cumulative distribution,
+    so after adding them up we only have to walk through the states of the part the state is in.
+    */
+    long long partSize = (size + MEASURE_PARTS - 1) / MEASURE_PARTS;
+    std::vector<double> partProbabilities(MEASURE_PARTS, 0);
+    threadPool().parallelFor(MEASURE_PARTS, [&](long long begin, long long end){
+        for(long long part = begin; part < end; part++){
+            long long start = std::min(size, part * partSize);
+            partProbabilities[part] = normKernel(amp + start, std::min(size, start + partSize) - start);
+        }
+    }, 1);
+
+    double total = 0;
+    for(double probability : partProbabilities){
+        total += probability;
+    }
+    // If every state has probability 0, this likely means that a non-unitary transformation was used somewhere in the code.
+    assert(total > 0);
+
+    double target = generateRandomDouble() * total;
+    long long part = 0;
+    while(part < MEASURE_PARTS - 1 && target >= partProbabilities[part]){
+        target -= partProbabilities[part];
+        part++;
+    }
+    // Rounding can carry us past the last part with any probability, in which case we pick the last state of that part.
+    while(partProbabilities[part] == 0){
+        part--;
+    }
+    StateIndex chosen = 0;
+    for(long long i = part * partSize; i < std::min(size, (part + 1) * partSize); i++){
+        double probability = std::norm(amp[i]);
+        if(probability == 0){
+            continue;
+        }
+        chosen = i;
+        if(target < probability){
+            break;
+        }
+        target -= probability;
+    }
+    StateIndex measuredMask = gather.getMask();
+    StateIndex outcome = chosen & measuredMask;
+
+    // Remove every state that disagrees with the outcome, adding up the probability of the rest.
+    std::vector<double> keptProbabilities(MEASURE_PARTS, 0);
+    threadPool().parallelFor(MEASURE_PARTS, [&](long long begin, long long end){
+        for(long long part = begin; part < end; part++){
+            long long partEnd = std::min(size, (part + 1) * partSize);
+            double sum = 0;
+            for(long long i = std::min(size, part * partSize); i < partEnd; i += runLength){
+                long long length = std::min(runLength, partEnd - i);
+                if((i & measuredMask) != outcome){
+                    std::fill(amp + i, amp + i + length, 0);
+                }
+                else{
+                    sum += runLength == 1 ? std::norm(amp[i]) : runNorm(amp + i, length);
+                }
+            }
+            keptProbabilities[part] = sum;
+        }
+    }, 1);
+    double keptProbability = 0;
+    for(double probability : keptProbabilities){
+        keptProbability += probability;
+    }
+
+    // Scale up the states we kept so that the probabilities sum to 1.
+    double scale = 1/sqrt(keptProbability);
+    forEachDenseRun(positions, [&](long long base, long long length){
+        scaleRun(amp + (base | outcome), length, scale);
+    });
+    return BasisState(gather.extract(outcome), measureSize);
+}
+
+ControlBits QuantumRegister::makeControlBits(const std::vector<int>& controls, StateIndex controlValues, const std::vector<int>& qubitsToApply) const {
+    int k = controls.size();
+    ControlBits bits;
+    for(int i = 0; i < k; i++){
+        // A control cannot have been measured already, appear twice, or also be one of the qubits the gate acts on.
+        assert(measuredQubits.find(controls[i]) == measuredQubits.end());
+        assert(std::find(qubitsToApply.begin(), qubitsToApply.end(), controls[i]) == qubitsToApply.end());
+        StateIndex bit = StateIndex(1) << qubitBitPosition(controls[i], this->numQubits);
+        assert(!(bits.mask & bit));
+        bits.mask |= bit;
+        if((controlValues >> (k - 1 - i)) & 1){
+            bits.value |= bit;
+        }
+    }
+    return bits;
+}
+
+void QuantumRegister::applyUnitary(const Unitary& u, const std::vector<int>& qubitsToApply){
+    applyControlledUnitary(u, qubitsToApply, ControlBits());
+}
+
+void QuantumRegister::applyUnitary(const Unitary& u, const std::vector<int>& controls, const std::vector<int>& qubitsToApply, StateIndex controlValues){
+    applyControlledUnitary(u, qubitsToApply, makeControlBits(controls, controlValues, qubitsToApply));
+}
+
+void QuantumRegister::applyControlledUnitary(const Unitary& u, const std::vector<int>& qubitsToApply, const ControlBits& controls){
+    for(int i : qubitsToApply){
+        // Make sure that we are not applying a unitary to a qubit we already measured.
+        assert(measuredQubits.find(i) == measuredQubits.end());
+    }
+
+    int m = qubitsToApply.size();
+    assert((1 << m) == u.size());
+
+    // Diagonal gates only multiply each coefficient by a phase, so they never need to move any states around.
+    if(u.getStructure() == DIAGONAL){
+        applyDiagonal(u.getPhases().data(), qubitsToApply, controls);
+        return;
+    }
+
+    // Single-qubit gates (by far the most common) have a dedicated in-place path.
+    if(m == 1){
+        const std::complex<double> gate[2][2] = {
+            {u[0][0], u[0][1]},
+            {u[1][0], u[1][1]}
+        };
+        applyControlledSingleQubitGate(gate, qubitsToApply[0], controls);
+        return;
+    }
+
+    // Permutation gates send each state to exactly one other state, so they only need to move states around.
+    if(u.getStructure() == PERMUTATION){
+        applyPermutation(u.getPermutation().data(), u.getPhases().data(), qubitsToApply, controls);
+        return;
+    }
 
-QuantumRegister::QuantumRegister(int _qubits): numQubits(_qubits) {
-    superposition[0] = 1;
+    if(representation == DENSE){
+        applyUnitaryDense(u, qubitsToApply, controls);
+        return;
+    }
+    if(representation == SORTED){
+        applyUnitarySorted(u, qubitsToApply, controls);
+    }
+    else{
+        applyUnitarySparse(u, qubitsToApply, controls);
+    }
+    updateRepresentation(false);
 }
 
-QuantumRegister::QuantumRegister(int _qubits, std::unordered_map<int, std::complex<double>> _superposition): numQubits(_qubits), superposition(_superposition){}
+template <typename Gate>
+void QuantumRegister::applyUnitarySparse(const Gate& u, const std::vector<int>& qubitsToApply, const ControlBits& controls){
+    QubitGather gather(qubitsToApply, this->numQubits);
+    std::vector<StateIndex> offsets = subStateOffsets(qubitsToApply, this->numQubits);
+    // Accumulate the result in the spare map. A unitary usually leaves about as many states occupied as it found, so we reserve that many up front.
+    AmplitudeMap& unitaryResult = spareSuperposition;
+    unitaryResult.clear();
+    unitaryResult.reserve(superposition.size());
+    for(const auto& entry : superposition){
+        StateIndex state = entry.first;
+        std::complex<double> coeff = entry.second;
+        if((state & controls.mask) != controls.value){
+            // The gate never changes the controls, so nothing else contributes to this state.
+            unitaryResult.insertNew(state, coeff);
+            continue;
+        }
+        StateIndex otherQubits = state & ~gather.getMask();
+
+        // Column j of u is the image of |j>, so this state contributes u[i][j] * coeff to every state i.
+        int j = gather.extract(state);
+        for(int i = 0; i < (int)u.size(); i++){
+            if(u[i][j] != 0.0){
+                unitaryResult[otherQubits | offsets[i]] += coeff * u[i][j];
+            }
+        }
+    }
 
-int QuantumRegister::numStates(){
-    return superposition.size();
+    // The result becomes the superposition, and the old superposition is kept as the spare map for the next gate.
+    superposition.swap(unitaryResult);
+
+    // If a state's probability of occuring is sufficiently small, it's safe to ignore it.
+    prune(0, 0, true);
+}
+
+void QuantumRegister::applyUnitary(const FixedUnitary<1>& u, const std::vector<int>& qubitsToApply){
+    assert(qubitsToApply.size() == 1);
+    assert(measuredQubits.find(qubitsToApply[0]) == measuredQubits.end());
+
+    if(u.isDiagonal()){
+        const std::complex<double> phases[2] = {u[0][0], u[1][1]};
+        applyDiagonal(phases, qubitsToApply);
+        return;
+    }
+    const std::complex<double> gate[2][2] = {
+        {u[0][0], u[0][1]},
+        {u[1][0], u[1][1]}
+    };
+    applySingleQubitGate(gate, qubitsToApply[0]);
+}
+
+void QuantumRegister::applyUnitary(const FixedUnitary<1>& u, const std::vector<int>& controls, const std::vector<int>& qubitsToApply, StateIndex controlValues){
+    assert(qubitsToApply.size() == 1);
+    assert(measuredQubits.find(qubitsToApply[0]) == measuredQubits.end());
+    ControlBits bits = makeControlBits(controls, controlValues, qubitsToApply);
+
+    if(u.isDiagonal()){
+        const std::complex<double> phases[2] = {u[0][0], u[1][1]};
+        applyDiagonal(phases, qubitsToApply, bits);
+        return;
+    }
+    const std::complex<double> gate[2][2] = {
+        {u[0][0], u[0][1]},
+        {u[1][0], u[1][1]}
+    };
+    applyControlledSingleQubitGate(gate, qubitsToApply[0], bits);
 }
 
-std::complex<double> QuantumRegister::getCoefficient(int state) const {
-    auto iterator = superposition.find(state);
-    if(iterator != superposition.end()){
-        return iterator->second;
+void QuantumRegister::applyUnitary(const FixedUnitary<2>& u, const std::vector<int>& qubitsToApply){
+    assert(qubitsToApply.size() == 2);
+    for(int i : qubitsToApply){
+        assert(measuredQubits.find(i) == measuredQubits.end());
+    }
+
+    if(u.isDiagonal()){
+        const std::complex<double> phases[4] = {u[0][0], u[1][1], u[2][2], u[3][3]};
+        applyDiagonal(phases, qubitsToApply);
+        return;
+    }
+    if(u.isPermutation()){
+        // Column j only has a non-zero entry in one row, which is where state j goes (as in Unitary::getPermutation and getPhases).
+        int permutation[4];
+        std::complex<double> phases[4];
+        for(int j = 0; j < 4; j++){
+            for(int i = 0; i < 4; i++){
+                if(u[i][j] != 0.0){
+                    permutation[j] = i;
+                    phases[j] = u[i][j];
+                }
+            }
+        }
+        applyPermutation(permutation, phases, qubitsToApply, ControlBits());
+        return;
+    }
+
+    if(representation == DENSE){
+        applyTwoQubitGateDense(u.data(), qubitsToApply);
+        return;
+    }
+    if(representation == SORTED){
+        applyUnitarySorted(u, qubitsToApply, ControlBits());
     }
     else{
-        return 0;
+        applyUnitarySparse(u, qubitsToApply, ControlBits());
     }
+    updateRepresentation(false);
 }
 
-double QuantumRegister::probability(int state) const {
-    return std::norm(getCoefficient(state));
+void QuantumRegister::applySingleQubitGate(const std::complex<double> (&u)[2][2], int qubit){
+    applyControlledSingleQubitGate(u, qubit, ControlBits());
 }
 
-BasisState QuantumRegister::measure(const std::vector<int>& qubitsToMeasure){
-    for(int i : qubitsToMeasure){
-        // Make sure that we are not re-measuring a qubit.
-        assert(measuredQubits.find(i) == measuredQubits.end());
-        
-        measuredQubits.insert(i);
+void QuantumRegister::applyControlledSingleQubitGate(const std::complex<double> (&u)[2][2], int qubit, const ControlBits& controls){
+    // Make sure that we are not applying a unitary to a qubit we already measured.
+    assert(measuredQubits.find(qubit) == measuredQubits.end());
+
+    // Every state where the qubit is 0 is paired with the state where it is 1 (i and i | mask). Each pair is updated in place.
+    StateIndex mask = StateIndex(1) << qubitBitPosition(qubit, this->numQubits);
+    std::complex<double> u00 = u[0][0], u01 = u[0][1], u10 = u[1][0], u11 = u[1][1];
+
+    if(representation == DENSE){
+        std::complex<double>* amp = amplitudes.data();
+        if(mask == 1 && controls.mask == 0){
+            // The two states of every pair are next to each other.
+            threadPool().parallelFor(amplitudes.size() / 2, [&](long long begin, long long end){
+                applyAdjacentPairKernel(amp + 2*begin, end - begin, u);
+            });
+        }
+        else{
+            // The states where the qubit is 0 come in runs of mask consecutive states, and their partners are mask further along.
+            forEachDenseRun({qubitBitPosition(qubit, this->numQubits)}, [&](long long base, long long length){
+                applyPairKernel(amp + base, length, mask, u);
+            }, controls);
+        }
+        return;
     }
+    if(representation == SORTED){
+        applySingleQubitGateSorted(u, mask, controls);
+        updateRepresentation(false);
+        return;
+    }
+
+    /*
+    Every pair with at least one non-zero state is handled once: by its state where the qubit is 0 if that one is non-zero, and otherwise by
+    its state where the qubit is 1. The new coefficients are written into the spare map, which is then swapped in.
+    */
+    spareSuperposition.clear();
+    spareSuperposition.reserve(2 * superposition.size());
 
-    struct MeasurementOutcome{
-        double probability = 0;
-        std::unordered_map<int, std::complex<double>> superposition;
+    // Sets a coefficient in the new superposition, unless the state is sufficiently unlikely to occur.
+    long long droppedStates = 0;
+    double droppedProbability = 0;
+    auto setCoefficient = [&](StateIndex state, std::complex<double> coeff){
+        double probability = std::norm(coeff);
+        if(probability >= pruningPolicy.threshold){
+            spareSuperposition.insertNew(state, coeff);
+        }
+        else if(probability > 0){
+            droppedStates++;
+            droppedProbability += probability;
+        }
     };
-    std::unordered_map<int, MeasurementOutcome> possibleOutcomes;
 
     for(const auto& entry : superposition){
-        int state = entry.first;
-        std::complex<double> coeff = entry.second;
+        StateIndex state = entry.first;
+        if((state & controls.mask) != controls.value){
+            spareSuperposition.insertNew(state, entry.second);
+            continue;
+        }
+        if((state & mask) && superposition.find(state ^ mask)){
+            continue;
+        }
+        StateIndex state0 = state & ~mask;
+        StateIndex state1 = state | mask;
+        std::complex<double> a0 = getCoefficient(state0);
+        std::complex<double> a1 = getCoefficient(state1);
+        setCoefficient(state0, u00 * a0 + u01 * a1);
+        setCoefficient(state1, u10 * a0 + u11 * a1);
+    }
+    superposition.swap(spareSuperposition);
+    prune(droppedStates, droppedProbability);
+
+    updateRepresentation(false);
+}
+
+void QuantumRegister::applySingleQubitGateSorted(const std::complex<double> (&u)[2][2], StateIndex mask, const ControlBits& controls){
+    /*
+    With the qubit's bit cleared, the states where the qubit is 0 are still in increasing order, and so are the states where it is 1.
+    So we walk through both at once, the way two sorted lists are merged, and meet the two states of every pair without any lookups.
+    The new states where the qubit is 0 come out in order (at the front of the spare array), and so do the new states where it is 1
+    (from the middle of the spare array on). A final merge of the two puts the register back in order.
+    */
+    std::complex<double> u00 = u[0][0], u01 = u[0][1], u10 = u[1][0], u11 = u[1][1];
+    size_t numStates = sortedStates.size();
+    const AmplitudeMap::Entry* states = sortedStates.data();
+    spareSortedStates.resize(2 * numStates);
+    AmplitudeMap::Entry* zeros = spareSortedStates.data();
+    AmplitudeMap::Entry* ones = zeros + numStates;
+    size_t numZeros = 0, numOnes = 0;
+    long long droppedStates = 0;
+    double droppedProbability = 0;
+
+    // Returns the position of the first state at or after i whose qubit has the given value (mask or 0).
+    auto nextWithBit = [&](size_t i, StateIndex bit){
+        while(i < numStates && (states[i].first & mask) != bit){
+            i++;
+        }
+        return i;
+    };
+    const StateIndex NONE = ~StateIndex(0);
+    size_t i0 = nextWithBit(0, 0);
+    size_t i1 = nextWithBit(0, mask);
+    while(i0 < numStates || i1 < numStates){
+        StateIndex state0 = i0 < numStates ? states[i0].first : NONE;
+        StateIndex state1 = i1 < numStates ? states[i1].first & ~mask : NONE;
+        StateIndex state = std::min(state0, state1);
 
-        BasisState allQubits(state, this->numQubits);
-        BasisState measuredQubitValues(0, 0);
-        for(int i : qubitsToMeasure){
-            measuredQubitValues.addQubit(allQubits.getQubit(i));
+        std::complex<double> a0 = 0, a1 = 0;
+        if(state0 == state){
+            a0 = states[i0].second;
+            i0 = nextWithBit(i0 + 1, 0);
+        }
+        if(state1 == state){
+            a1 = states[i1].second;
+            i1 = nextWithBit(i1 + 1, mask);
         }
 
-        possibleOutcomes[measuredQubitValues.toInteger()].probability += this->probability(state);
-        possibleOutcomes[measuredQubitValues.toInteger()].superposition[state] += coeff;
+        // The states where the controls do not match keep their coefficients.
+        std::complex<double> b0 = a0, b1 = a1;
+        if((state & controls.mask) == controls.value){
+            b0 = u00 * a0 + u01 * a1;
+            b1 = u10 * a0 + u11 * a1;
+        }
+        double p0 = std::norm(b0), p1 = std::norm(b1);
+        if(p0 >= pruningPolicy.threshold){
+            zeros[numZeros++] = {state, b0};
+        }
+        else if(p0 > 0){
+            droppedStates++;
+            droppedProbability += p0;
+        }
+        if(p1 >= pruningPolicy.threshold){
+            ones[numOnes++] = {state | mask, b1};
+        }
+        else if(p1 > 0){
+            droppedStates++;
+            droppedProbability += p1;
+        }
     }
 
-    int measureSize = qubitsToMeasure.size();
-    int remainingSize = this->numQubits - measureSize;
+    sortedStates.resize(numZeros + numOnes);
+    std::merge(zeros, zeros + numZeros, ones, ones + numOnes, sortedStates.begin(), stateLess);
+    prune(droppedStates, droppedProbability);
+}
 
-    double rand = generateRandomDouble();
-    double sum = 0;
-    for(auto& entry : possibleOutcomes){
-        int state = entry.first;
-        MeasurementOutcome& mo = entry.second;
-        sum += mo.probability;
-        if(sum >= rand){
-            // Scale up the coefficients so that the probabilities sum to 1.
-            for(auto& entry2 : mo.superposition){
-                std::complex<double>& coeff = entry2.second;
-                coeff *= 1/sqrt(mo.probability);
+template <typename Gate>
+void QuantumRegister::applyUnitarySorted(const Gate& u, const std::vector<int>& qubitsToApply, const ControlBits& controls){
+    QubitGather gather(qubitsToApply, this->numQubits);
+    std::vector<StateIndex> offsets = subStateOffsets(qubitsToApply, this->numQubits);
+
+    // Write out every contribution u[i][j] * coeff separately, then sort them so that the contributions to the same state end up next to each other.
+    spareSortedStates.clear();
+    for(const auto& entry : sortedStates){
+        if((entry.first & controls.mask) != controls.value){
+            spareSortedStates.push_back(entry);
+            continue;
+        }
+        StateIndex otherQubits = entry.first & ~gather.getMask();
+        int j = gather.extract(entry.first);
+        for(int i = 0; i < (int)u.size(); i++){
+            if(u[i][j] != 0.0){
+                spareSortedStates.push_back({otherQubits | offsets[i], entry.second * u[i][j]});
             }
-            this->superposition = mo.superposition;
-            return BasisState(state, measureSize);
         }
     }
+    std::sort(spareSortedStates.begin(), spareSortedStates.end(), stateLess);
+
+    sortedStates.clear();
+    long long droppedStates = 0;
+    double droppedProbability = 0;
+    for(size_t k = 0; k < spareSortedStates.size();){
+        StateIndex state = spareSortedStates[k].first;
+        std::complex<double> coeff = 0;
+        for(; k < spareSortedStates.size() && spareSortedStates[k].first == state; k++){
+            coeff += spareSortedStates[k].second;
+        }
+        // If a state's probability of occuring is sufficiently small, it's safe to ignore it.
+        double probability = std::norm(coeff);
+        if(probability >= pruningPolicy.threshold){
+            sortedStates.push_back({state, coeff});
+        }
+        else if(probability > 0){
+            droppedStates++;
+            droppedProbability += probability;
+        }
+    }
+    prune(droppedStates, droppedProbability);
+}
+
+void QuantumRegister::applyBijection(const Bijection& f, const std::vector<int>& qubitsToApply){
+    applyControlledBijection(f, qubitsToApply, ControlBits());
+}
 
-    // If we break out of the above loop, this means that the probabilities do not sum to 1. 
-    // This likely means that a non-unitary transformation was used somewhere in the code.
-    assert(false);
+void QuantumRegister::applyBijection(const Bijection& f, const std::vector<int>& controls, const std::vector<int>& qubitsToApply, StateIndex controlValues){
+    applyControlledBijection(f, qubitsToApply, makeControlBits(controls, controlValues, qubitsToApply));
 }
 
-void QuantumRegister::applyUnitary(const Unitary& u, const std::vector<int>& qubitsToApply){
+void QuantumRegister::applyControlledBijection(const Bijection& f, const std::vector<int>& qubitsToApply, const ControlBits& controls){
     for(int i : qubitsToApply){
-        // Make sure that we are not applying a unitary to a qubit we already measured.
+        // Make sure that we are not applying a function to a qubit we already measured.
         assert(measuredQubits.find(i) == measuredQubits.end());
     }
 
     int m = qubitsToApply.size();
-    assert((1 << m) == u.size());
+    assert((StateIndex(1) << m) == f.size());
 
-    std::unordered_map<int, std::complex<double>> unitaryResult;
-    for(const auto& entry : superposition){
-        int state = entry.first;
-        std::complex<double> coeff = entry.second;
-        
-        BasisState allQubits(state, this->numQubits);
-        BasisState relevantQubits(0, m);
-        for(int i = 0; i < m; i++){
-            relevantQubits.setQubit(i, allQubits.getQubit(qubitsToApply[i]));
+    if(representation == DENSE){
+        applyBijectionDense(f, qubitsToApply, controls);
+        return;
+    }
+
+    remapSparseStates(qubitsToApply, [&f](StateIndex x){
+        return std::pair<StateIndex, std::complex<double>>(f.apply(x), 1);
+    }, controls);
+}
+
+void QuantumRegister::applyModularMultiplication(StateIndex multiplier, StateIndex modulus, const std::vector<int>& controls, const std::vector<int>& qubitsToApply,
+                                                 StateIndex controlValues){
+    for(int i : qubitsToApply){
+        // Make sure that we are not applying a function to a qubit we already measured.
+        assert(measuredQubits.find(i) == measuredQubits.end());
+    }
+    int m = qubitsToApply.size();
+    assert(modulus > 0 && (m == MAX_QUBITS || modulus <= (StateIndex(1) << m)));
+    ControlBits bits = makeControlBits(controls, controlValues, qubitsToApply);
+
+    // With a modulus above 2^32 the product is taken in 128 bits so that it cannot overflow (this is much slower, so it is only done when needed).
+    multiplier %= modulus;
+    bool wide = modulus > (StateIndex(1) << 32);
+    auto multiply = [multiplier, modulus, wide](StateIndex x){
+        if(x >= modulus){
+            return x;
         }
+        return wide ? (StateIndex)((unsigned __int128)multiplier * x % modulus) : multiplier * x % modulus;
+    };
 
-        for(int j = 0; j < (int)u.size(); j++){
-            int i = relevantQubits.toInteger();
-            if(u[i][j] != 0.0){
-                std::complex<double> newCoeff = coeff * u[i][j];
-                BasisState appliedQubits(j, m);
-                for(int k = 0; k < m; k++){
-                    allQubits.setQubit(qubitsToApply[k], appliedQubits.getQubit(k));
-                }
-                unitaryResult[allQubits.toInteger()] += newCoeff;
+    if(representation == DENSE){
+        // A dense register goes through every value anyway, so the products are computed once (see applyBijectionDense).
+        applyBijectionDense(Bijection(StateIndex(1) << m, multiply), qubitsToApply, bits);
+        return;
+    }
+
+    remapSparseStates(qubitsToApply, [&multiply](StateIndex x){
+        return std::pair<StateIndex, std::complex<double>>(multiply(x), 1);
+    }, bits);
+}
+
+void QuantumRegister::applyFourierTransform(int start, int end, bool inverse){
+    assert(0 <= start && start <= end && end < this->numQubits);
+    for(int i = start; i <= end; i++){
+        // Make sure that we are not applying the transform to a qubit we already measured.
+        assert(measuredQubits.find(i) == measuredQubits.end());
+    }
+
+    /*
+    The wires start to end hold bits lowBits to lowBits + m - 1 of the state index, with end in the lowest one. So for each value of the qubits before start
+    (a slice), the amplitudes of a dense register form a 2^m x 2^lowBits matrix stored row by row, where row j holds the states where the wires have
+    the value j. The transform is a discrete Fourier transform of every column of this matrix, so we run a radix-2 FFT on whole rows at a time.
+    */
+    int m = end - start + 1;
+    int lowBits = qubitBitPosition(end, this->numQubits);
+    long long numRows = 1LL << m;
+
+    if(representation == DENSE){
+        /*
+        The FFT takes its input with the bits of the row numbers reversed, and then gives its output in the natural order. The QFT circuit reverses
+        its wires with SWAP gates at the end instead (a pass over the state for each of the m / 2 gates), while reversing the bits here is a single pass
+        that exchanges every pair of wires at once (see swapQubits).
+        */
+        std::vector<std::pair<int, int>> pairs;
+        for(int i = start, j = end; i < j; i++, j--){
+            pairs.push_back({i, j});
+        }
+        swapQubits(pairs);
+        fourierStages(amplitudes.data(), amplitudes.size() >> (m + lowBits), m, lowBits, inverse, threadPool());
+        return;
+    }
+
+    /*
+    A sparse (or sorted) register transforms each group of states that share the values of the other qubits on its own. The coefficients of a group
+    are written into an array of 2^m rows of length 1 (already in bit-reversed order), and every value of the FFT above the pruning threshold becomes a state.
+    This costs O(m 2^m) for every group, however many states the group had (the transform fills all 2^m values anyway).
+    */
+    StateIndex rangeMask = (StateIndex(numRows) - 1) << lowBits;
+    auto groupLess = [rangeMask](const AmplitudeMap::Entry& a, const AmplitudeMap::Entry& b){
+        return (a.first & ~rangeMask) < (b.first & ~rangeMask);
+    };
+    std::vector<AmplitudeMap::Entry> states;
+    if(representation == SORTED){
+        states.swap(sortedStates);
+    }
+    else{
+        states.reserve(superposition.size());
+        for(const auto& entry : superposition){
+            states.push_back(entry);
+        }
+    }
+    std::sort(states.begin(), states.end(), groupLess);
+
+    std::vector<AmplitudeMap::Entry> transformed;
+    Vector rows(numRows);
+    long long droppedStates = 0;
+    double droppedProbability = 0;
+    for(size_t k = 0; k < states.size();){
+        StateIndex otherQubits = states[k].first & ~rangeMask;
+        std::fill(rows.begin(), rows.end(), std::complex<double>(0));
+        for(; k < states.size() && (states[k].first & ~rangeMask) == otherQubits; k++){
+            rows[reverseBits((states[k].first & rangeMask) >> lowBits, m)] = states[k].second;
+        }
+        fourierStages(rows.data(), 1, m, 0, inverse, threadPool());
+        for(long long j = 0; j < numRows; j++){
+            // If a state's probability of occuring is sufficiently small, it's safe to ignore it.
+            double probability = std::norm(rows[j]);
+            if(probability >= pruningPolicy.threshold){
+                transformed.push_back({otherQubits | (StateIndex(j) << lowBits), rows[j]});
+            }
+            else if(probability > 0){
+                droppedStates++;
+                droppedProbability += probability;
             }
         }
     }
 
-    // Add all non-zero entries to superposition
-    superposition.clear();
-    for(const auto& entry : unitaryResult){
-        int state = entry.first;
-        std::complex<double> coeff = entry.second;
-        
-        // If a state's probability of occuring is sufficiently small, it's safe to ignore it.
-        double prob = std::norm(coeff);
-        if(prob >= MIN_PROBABILITY){
-            superposition[state] = coeff;
+    if(representation == SORTED){
+        std::sort(transformed.begin(), transformed.end(), stateLess);
+        sortedStates.swap(transformed);
+    }
+    else{
+        superposition.clear();
+        superposition.reserve(transformed.size());
+        for(const auto& entry : transformed){
+            superposition.insertNew(entry.first, entry.second);
         }
     }
+    prune(droppedStates, droppedProbability);
+    updateRepresentation(false);
 }
 
-void QuantumRegister::applyBijection(const Bijection& f, const std::vector<int>& qubitsToApply){
+void QuantumRegister::applyDiagonal(const std::complex<double>* phases, const std::vector<int>& qubitsToApply, const ControlBits& controls){
+    if(representation == DENSE){
+        // Only the values of the qubits whose phase is not 1 need to be touched (e.g. just 1 of the 4 for a controlled phase gate).
+        std::vector<int> changed;
+        for(int s = 0; s < (1 << qubitsToApply.size()); s++){
+            if(phases[s] != 1.0){
+                changed.push_back(s);
+            }
+        }
+        if(changed.empty()){
+            return;
+        }
+
+        std::vector<StateIndex> offsets = subStateOffsets(qubitsToApply, this->numQubits);
+        std::complex<double>* amp = amplitudes.data();
+        forEachDenseRun(sortedBitPositions(qubitsToApply, this->numQubits), [&](long long base, long long length){
+            for(int s : changed){
+                scaleKernel(amp + (base | offsets[s]), length, phases[s]);
+            }
+        }, controls);
+        return;
+    }
+
+    QubitGather gather(qubitsToApply, this->numQubits);
+    forEachSparseState([&](AmplitudeMap::Entry& entry){
+        if((entry.first & controls.mask) == controls.value){
+            entry.second *= phases[gather.extract(entry.first)];
+        }
+    });
+}
+
+void QuantumRegister::applyPermutation(const int* permutation, const std::complex<double>* phases, const std::vector<int>& qubitsToApply, const ControlBits& controls){
+    if(representation == DENSE){
+        // Permute the runs of coefficients sharing the same other qubits.
+        std::vector<StateIndex> offsets = subStateOffsets(qubitsToApply, this->numQubits);
+        std::vector<int> cycles = permutationCycles(permutation, 1 << qubitsToApply.size());
+        std::complex<double>* amp = amplitudes.data();
+        forEachDenseRun(sortedBitPositions(qubitsToApply, this->numQubits), [&](long long base, long long length){
+            thread_local Vector buffer;
+            buffer.resize(length);
+            permuteRun(amp, base, length, offsets, permutation, phases, cycles, buffer.data());
+        }, controls);
+        return;
+    }
+
+    remapSparseStates(qubitsToApply, [permutation, phases](StateIndex s){
+        return std::pair<StateIndex, std::complex<double>>(permutation[s], phases[s]);
+    }, controls);
+}
+
+void QuantumRegister::applyRotation(const Rotation& f, const std::vector<int>& qubitsToApply){
+    applyControlledRotation(f, qubitsToApply, ControlBits());
+}
+
+void QuantumRegister::applyRotation(const Rotation& f, const std::vector<int>& controls, const std::vector<int>& qubitsToApply, StateIndex controlValues){
+    applyControlledRotation(f, qubitsToApply, makeControlBits(controls, controlValues, qubitsToApply));
+}
+
+void QuantumRegister::applyControlledRotation(const Rotation& f, const std::vector<int>& qubitsToApply, const ControlBits& controls){
     for(int i : qubitsToApply){
         // Make sure that we are not applying a function to a qubit we already measured.
         assert(measuredQubits.find(i) == measuredQubits.end());
     }
 
     int m = qubitsToApply.size();
-    assert((1 << m) == f.size());
+    assert((StateIndex(1) << m) == f.size());
 
-    std::unordered_map<int, std::complex<double>> bijectionResult;
-    for(const auto& entry : superposition){
-        int state = entry.first;
-        std::complex<double> coeff = entry.second;
-        
-        BasisState allQubits(state, this->numQubits);
-        BasisState relevantQubits(0, m);
-        for(int i = 0; i < m; i++){
-            relevantQubits.setQubit(i, allQubits.getQubit(qubitsToApply[i]));
-        }
+    if(representation == DENSE){
+        applyRotationDense(f, qubitsToApply, controls);
+        return;
+    }
 
-        int x = relevantQubits.toInteger();
-        int fx = f.apply(x);
-        BasisState appliedQubits(fx, m);
-        for(int k = 0; k < m; k++){
-            allQubits.setQubit(qubitsToApply[k], appliedQubits.getQubit(k));
+    QubitGather gather(qubitsToApply, this->numQubits);
+    forEachSparseState([&](AmplitudeMap::Entry& entry){
+        if((entry.first & controls.mask) == controls.value){
+            std::complex<double> rotation = f.getRotation(gather.extract(entry.first));
+            entry.second *= rotation;
         }
-        bijectionResult[allQubits.toInteger()] = coeff;
+    });
+}
+
+void QuantumRegister::applyUnitaryDense(const Unitary& u, const std::vector<int>& qubitsToApply, const ControlBits& controls){
+    int m = qubitsToApply.size();
+    int subSize = 1 << m;
+    if(m == 2){
+        applyTwoQubitGateDense(u.data(), qubitsToApply, controls);
+        return;
     }
 
-    superposition = bijectionResult;
+    // General case: apply u to each group of 2^m coefficients sharing the same other qubits. Consecutive groups are handed to the kernel together.
+    std::complex<double>* amp = amplitudes.data();
+    std::vector<StateIndex> offsets = subStateOffsets(qubitsToApply, this->numQubits);
+    std::vector<int> positions = sortedBitPositions(qubitsToApply, this->numQubits);
+    forEachDenseRun(positions, [&](long long base, long long length){
+        // Each thread keeps its own scratch space around so that it is not reallocated for every run.
+        thread_local Vector scratch;
+        scratch.resize(4 * subSize);
+        applyMatrixKernel(amp + base, length, offsets.data(), subSize, u.data(), scratch.data());
+    }, controls);
 }
 
-void QuantumRegister::applyRotation(const Rotation& f, const std::vector<int>& qubitsToApply){
-    for(int i : qubitsToApply){
-        // Make sure that we are not applying a function to a qubit we already measured.
-        assert(measuredQubits.find(i) == measuredQubits.end());
+void QuantumRegister::applyTwoQubitGateDense(const std::complex<double>* u, const std::vector<int>& qubitsToApply, const ControlBits& controls){
+    std::complex<double>* amp = amplitudes.data();
+    std::vector<StateIndex> offsets = subStateOffsets(qubitsToApply, this->numQubits);
+    std::vector<int> positions = sortedBitPositions(qubitsToApply, this->numQubits);
+
+    if(u[0] == 1.0 && u[1] == 0.0 && u[4] == 0.0 && u[5] == 1.0){
+        // This is a controlled single-qubit gate (the first qubit is the control), so we only need to apply the bottom right block
+        // of u to the pairs where the control qubit is 1.
+        const std::complex<double> block[2][2] = {
+            {u[10], u[11]},
+            {u[14], u[15]}
+        };
+        StateIndex controlOffset = offsets[2];
+        StateIndex targetOffset = offsets[1];
+        forEachDenseRun(positions, [&](long long base, long long length){
+            applyPairKernel(amp + (base | controlOffset), length, targetOffset, block);
+        }, controls);
+        return;
     }
 
+    forEachDenseRun(positions, [&](long long base, long long length){
+        thread_local Vector scratch;
+        scratch.resize(4 * 4);
+        applyMatrixKernel(amp + base, length, offsets.data(), 4, u, scratch.data());
+    }, controls);
+}
+
+void QuantumRegister::applyBijectionDense(const Bijection& f, const std::vector<int>& qubitsToApply, const ControlBits& controls){
     int m = qubitsToApply.size();
-    assert((1 << m) == f.size());
+    std::vector<StateIndex> offsets = subStateOffsets(qubitsToApply, this->numQubits);
+    std::vector<int> positions = addControlPositions(sortedBitPositions(qubitsToApply, this->numQubits), controls.mask);
+    int subSize = 1 << m;
+    std::complex<double>* amp = amplitudes.data();
 
-    for(const auto& entry : superposition){
-        int state = entry.first;
-        
-        BasisState allQubits(state, this->numQubits);
-        BasisState relevantQubits(0, m);
-        for(int i = 0; i < m; i++){
-            relevantQubits.setQubit(i, allQubits.getQubit(qubitsToApply[i]));
+    // Look up where each value goes once, rather than once per group (f may be a function that is slow to call).
+    std::vector<StateIndex> imageOffsets(subSize);
+    for(int x = 0; x < subSize; x++){
+        imageOffsets[x] = offsets[f.apply(x)];
+    }
+
+    // Permute each group of 2^m coefficients sharing the same other qubits (and where the controls match).
+    threadPool().parallelFor(amplitudes.size() >> positions.size(), [&](long long begin, long long end){
+        Vector permuted(subSize);
+        for(long long i = begin; i < end; i++){
+            StateIndex base = insertZeroBits(i, positions) | controls.value;
+            for(int x = 0; x < subSize; x++){
+                permuted[x] = amp[base | offsets[x]];
+            }
+            for(int x = 0; x < subSize; x++){
+                amp[base | imageOffsets[x]] = permuted[x];
+            }
         }
+    });
+}
 
-        int x = relevantQubits.toInteger();
+void QuantumRegister::applyRotationDense(const Rotation& f, const std::vector<int>& qubitsToApply, const ControlBits& controls){
+    std::vector<StateIndex> offsets = subStateOffsets(qubitsToApply, this->numQubits);
+    std::complex<double>* amp = amplitudes.data();
+
+    // Look up the rotations once, and skip the values of the qubits that are not rotated at all (e.g. all but one for the Grover diffusion operator).
+    std::vector<std::pair<StateIndex, std::complex<double>>> rotations;
+    for(StateIndex x = 0; x < f.size(); x++){
+        // A callable oracle runs user code on every call, so each value is only looked up once.
         std::complex<double> rotation = f.getRotation(x);
-        superposition[state] *= rotation;
+        if(rotation != 1.0){
+            rotations.push_back({offsets[x], rotation});
+        }
+    }
+
+    forEachDenseRun(sortedBitPositions(qubitsToApply, this->numQubits), [&](long long base, long long length){
+        for(const auto& rotation : rotations){
+            scaleKernel(amp + (base | rotation.first), length, rotation.second);
+        }
+    }, controls);
+}
+
+void QuantumRegister::swapQubits(const std::vector<std::pair<int, int>>& pairs){
+    std::vector<int> qubits;
+    for(const auto& pair : pairs){
+        qubits.push_back(pair.first);
+        qubits.push_back(pair.second);
+    }
+    int m = qubits.size();
+
+    // The measured qubits move along with their values.
+    for(const auto& pair : pairs){
+        bool firstMeasured = measuredQubits.erase(pair.first);
+        bool secondMeasured = measuredQubits.erase(pair.second);
+        if(firstMeasured){
+            measuredQubits.insert(pair.second);
+        }
+        if(secondMeasured){
+            measuredQubits.insert(pair.first);
+        }
+    }
+
+    if(representation == DENSE){
+        /*
+        Order the pairs by their lower bit, and let lowOffsets[b] (highOffsets[a]) be the bits that value b (a) sets in the lower (higher) bits of the pairs.
+        For a fixed value of the other qubits, the states form a square matrix where entry (a, b) is the state with highOffsets[a] | lowOffsets[b],
+        and exchanging the bits of every pair transposes this matrix. We transpose it in small tiles, so that both the rows and the columns
+        being exchanged stay in cache.
+        */
+        std::vector<std::pair<int, int>> positionPairs;
+        for(const auto& pair : pairs){
+            int first = qubitBitPosition(pair.first, this->numQubits);
+            int second = qubitBitPosition(pair.second, this->numQubits);
+            positionPairs.push_back({std::min(first, second), std::max(first, second)});
+        }
+        std::sort(positionPairs.begin(), positionPairs.end());
+
+        int numPairs = pairs.size();
+        long long side = 1LL << numPairs;
+        std::vector<long long> lowOffsets(side, 0), highOffsets(side, 0);
+        for(long long v = 0; v < side; v++){
+            for(int k = 0; k < numPairs; k++){
+                if((v >> k) & 1){
+                    lowOffsets[v] |= 1LL << positionPairs[k].first;
+                    highOffsets[v] |= 1LL << positionPairs[k].second;
+                }
+            }
+        }
+
+        long long tile = 1LL << std::min(numPairs, 3);
+        long long numTiles = side / tile;
+        long long numGroups = amplitudes.size() >> m;
+        std::vector<int> positions = sortedBitPositions(qubits, this->numQubits);
+        std::complex<double>* amp = amplitudes.data();
+
+        // Each task is one row of tiles of one matrix, and swaps it with the matching column of tiles.
+        threadPool().parallelFor(numGroups * numTiles, [&](long long begin, long long end){
+            for(long long task = begin; task < end; task++){
+                long long base = insertZeroBits(task / numTiles, positions);
+                long long aTile = (task % numTiles) * tile;
+                for(long long bTile = aTile; bTile < side; bTile += tile){
+                    for(long long a = aTile; a < aTile + tile; a++){
+                        for(long long b = std::max(bTile, a + 1); b < bTile + tile; b++){
+                            std::swap(amp[base | highOffsets[a] | lowOffsets[b]], amp[base | highOffsets[b] | lowOffsets[a]]);
+                        }
+                    }
+                }
+            }
+        }, std::max(1LL, (1LL << 12) / (side * tile)));
+        return;
+    }
+
+    // Value s of the qubits becomes the value where the bits of each pair are exchanged.
+    remapSparseStates(qubits, [m](StateIndex s){
+        StateIndex image = 0;
+        for(int k = 0; k < m; k++){
+            image |= ((s >> (m - 1 - (k ^ 1))) & 1) << (m - 1 - k);
+        }
+        return std::pair<StateIndex, std::complex<double>>(image, 1);
+    });
+}
+
+void QuantumRegister::applyUnitariesBlocked(const std::vector<const Unitary*>& gates, const std::vector<std::vector<int>>& qubits, int blockQubits){
+    assert(representation == DENSE);
+    assert(gates.size() == qubits.size());
+    assert(blockQubits <= this->numQubits);
+
+    long long blockSize = 1LL << blockQubits;
+    int numGates = gates.size();
+    int maxSize = 1;
+    for(int g = 0; g < numGates; g++){
+        assert((1 << qubits[g].size()) == gates[g]->size());
+        for(int i : qubits[g]){
+            // Make sure that we are not applying a unitary to a qubit we already measured, and that the qubit is stored inside a block.
+            assert(measuredQubits.find(i) == measuredQubits.end());
+            assert(qubitBitPosition(i, this->numQubits) < blockQubits);
+        }
+        maxSize = std::max(maxSize, gates[g]->size());
+    }
+
+    std::vector<BlockGate> blockGates;
+    for(int g = 0; g < numGates; g++){
+        // Find the diagonal gates that come right after this one.
+        int end = g;
+        while(end < numGates && gates[end]->getStructure() == DIAGONAL){
+            end++;
+        }
+
+        /*
+        Several diagonal gates in a row (e.g. the controlled phase gates of the QFT), or one whose qubits are in the lowest bits (so that it is
+        applied in many tiny runs), are combined into a single table of phases. Every block has the same table, so it is only built once.
+        */
+        bool lowBits = end > g && sortedBitPositions(qubits[g], this->numQubits)[0] < 6;
+        if(end - g >= 2 || lowBits){
+            BlockGate gate;
+            gate.kind = BlockGate::TABLE;
+            gate.table.assign(blockSize, 1);
+            for(int h = g; h < end; h++){
+                QubitGather gather(qubits[h], this->numQubits);
+                const Vector& phases = gates[h]->getPhases();
+                for(long long state = 0; state < blockSize; state++){
+                    gate.table[state] *= phases[gather.extract(state)];
+                }
+            }
+            blockGates.push_back(std::move(gate));
+            g = end - 1;
+        }
+        else{
+            blockGates.push_back(makeBlockGate(*gates[g], qubits[g], this->numQubits));
+        }
+    }
+
+    std::complex<double>* amp = amplitudes.data();
+    threadPool().parallelFor(amplitudes.size() / blockSize, [&](long long begin, long long end){
+        Vector scratch(std::max(4LL * maxSize, blockSize / 2));
+        for(long long block = begin; block < end; block++){
+            for(const BlockGate& gate : blockGates){
+                applyBlockGate(gate, amp + block * blockSize, blockSize, scratch.data());
+            }
+        }
+    }, 1);
+}
+
+template <typename Function>
+void QuantumRegister::forEachDenseRun(const std::vector<int>& sortedPositions, Function function, const ControlBits& controls){
+    // The control bits are fixed as well, so they are left out of the runs like the qubits, and then set to their values.
+    std::vector<int> withControls;
+    const std::vector<int>* positions = &sortedPositions;
+    if(controls.mask != 0){
+        withControls = addControlPositions(sortedPositions, controls.mask);
+        positions = &withControls;
+    }
+
+    // The states where all of the qubits are 0 come in runs of 2^positions[0] consecutive states.
+    long long runLength = 1LL << (*positions)[0];
+    long long numRuns = (amplitudes.size() >> positions->size()) / runLength;
+    StateIndex value = controls.value;
+    threadPool().parallelFor(numRuns, [&](long long begin, long long end){
+        for(long long run = begin; run < end; run++){
+            function(insertZeroBits(run * runLength, *positions) | value, runLength);
+        }
+    }, std::max(1LL, (1LL << 12) / runLength));
+}
+
+template <typename Function>
+void QuantumRegister::forEachStoredState(Function function){
+    if(representation == DENSE){
+        for(StateIndex state = 0; state < amplitudes.size(); state++){
+            if(amplitudes[state] != 0.0){
+                function(state, amplitudes[state]);
+            }
+        }
+    }
+    else if(representation == SORTED){
+        for(auto& entry : sortedStates){
+            function(entry.first, entry.second);
+        }
+    }
+    else{
+        for(auto& entry : superposition){
+            function(entry.first, entry.second);
+        }
+    }
+}
+
+template <typename Function>
+void QuantumRegister::forEachSparseState(Function function){
+    if(representation == SORTED){
+        AmplitudeMap::Entry* states = sortedStates.data();
+        threadPool().parallelFor(sortedStates.size(), [&](long long begin, long long end){
+            for(long long k = begin; k < end; k++){
+                function(states[k]);
+            }
+        }, 1 << 12);
+        return;
+    }
+
+    // Each slot of the map holds a different state, so different threads can update different slots at the same time.
+    threadPool().parallelFor(superposition.numSlots(), [&](long long begin, long long end){
+        for(long long slot = begin; slot < end; slot++){
+            if(superposition.isOccupied(slot)){
+                function(superposition.entryAt(slot));
+            }
+        }
+    }, 1 << 12);
+}
+
+template <typename Remap>
+void QuantumRegister::remapSparseStates(const std::vector<int>& qubits, Remap remap, const ControlBits& controls){
+    if(representation == SORTED){
+        remapStates(sortedStates, spareSortedStates, qubits, this->numQubits, remap, controls);
     }
+    else{
+        remapStates(superposition, spareSuperposition, qubits, this->numQubits, remap, controls);
+    }
+}
+
+ThreadPool& QuantumRegister::threadPool(){
+    return ownThreadPool ? *ownThreadPool : ThreadPool::global();
+}
+
+void QuantumRegister::setNumThreads(int numThreads){
+    ownThreadPool = std::make_shared<ThreadPool>(numThreads);
+}
+
+int QuantumRegister::getNumThreads(){
+    return threadPool().size();
 }
 
 std::ostream& operator<<(std::ostream& os, const QuantumRegister& qr){
@@ -196,30 +2180,22 @@ std::ostream& operator<<(std::ostream& os, const QuantumRegister& qr){
         return os;
     }
 
-    // We copy the states into a map so that we can print them in order.
-    std::map<int, std::complex<double>> values;
-    for(const auto& entry : qr.superposition){
-        int state = entry.first;
-        std::complex<double> coeff = entry.second;
-        values[state] = coeff;
-    }
-    for(auto iterator = values.begin(); iterator != values.end(); iterator++){
-        if(iterator != values.begin()){
-            os << " + ";
-        }
-        int state = iterator->first;
-        std::complex<double> coeff = iterator->second;
+    std::vector<AmplitudeMap::Entry> values = qr.getStates();
 
-        BasisState allQubits(state, qr.numQubits);
-        BasisState unmeasuredQubits(0, 0);
-        for(int i = 0; i < qr.numQubits; i++){
-            // Only print out the qubit if it has not already been measured.
-            if(qr.measuredQubits.find(i) == qr.measuredQubits.end()){
-                unmeasuredQubits.addQubit(allQubits.getQubit(i));
-            }
+    // Only print out the qubits that have not already been measured.
+    std::vector<int> unmeasured;
+    for(int i = 0; i < qr.numQubits; i++){
+        if(qr.measuredQubits.find(i) == qr.measuredQubits.end()){
+            unmeasured.push_back(i);
         }
+    }
+    QubitGather gather(unmeasured, qr.numQubits);
 
-        os << coeff << unmeasuredQubits;
+    for(size_t k = 0; k < values.size(); k++){
+        if(k > 0){
+            os << " + ";
+        }
+        os << values[k].second << BasisState(gather.extract(values[k].first), unmeasured.size());
     }
     return os;
 }
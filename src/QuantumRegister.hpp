@@ -2,14 +2,95 @@
 #define QUANTUM_REGISTER_HPP
 
 #include "Unitary.hpp"
+#include "FixedUnitary.hpp"
 #include "BasisState.hpp"
 #include "Function.hpp"
+#include "AlignedAllocator.hpp"
+#include "ThreadPool.hpp"
+#include "AmplitudeMap.hpp"
 #include <vector>
 #include <complex>
 #include <ostream>
 #include <map>
 #include <unordered_map>
 #include <unordered_set>
+#include <memory>
+
+/*
+The ways a quantum register can store its superposition.
+SPARSE only stores the basis states with a non-zero coefficient in a hash map. This is cheap when few states are occupied.
+DENSE stores a coefficient for every one of the 2^n basis states in a contiguous array, and updates it in place.
+This avoids hashing and allocation once most of the states are occupied (e.g. after a layer of Hadamard gates).
+SORTED also only stores the basis states with a non-zero coefficient, but in an array sorted by state. Single-qubit gates and measurements are then
+linear scans over the array with no hashing at all, which suits states that are too full for a hash map but too empty for a dense array.
+Gates that move states around (bijections, permutations and wider unitaries) have to sort the array again, so those are slower than with SPARSE.
+*/
+enum Representation {
+    SPARSE, DENSE, SORTED
+};
+
+/*
+Controls when a register switches between representations on its own.
+The fill ratio of a register is the fraction of its 2^n basis states that have a non-zero coefficient.
+A sparse register becomes dense once its fill ratio reaches denseThreshold, and a dense register becomes sparse once a measurement drops its fill ratio
+to sparseThreshold. Counting the states of a dense register takes a full pass, so this is only checked after a measurement: a dense register that
+empties out through gates alone (e.g. Hadamard gates undoing each other) stays dense until the next measurement, or until setRepresentation is called.
+Keeping sparseThreshold well below denseThreshold stops a register from converting back and forth on every gate.
+Registers with more than maxDenseQubits qubits always stay sparse, since the dense array would not fit in memory.
+While a register is sparse, it uses sparseRepresentation (SPARSE or SORTED).
+*/
+struct AdaptivePolicy {
+    bool enabled = true;
+    double denseThreshold = 1.0 / 8;
+    double sparseThreshold = 1.0 / 64;
+    int maxDenseQubits = 26;
+    Representation sparseRepresentation = SPARSE;
+};
+
+// Counts how often (and for how long) a register has converted between representations.
+struct RepresentationStats {
+    int sparseToDenseConversions = 0;
+    int denseToSparseConversions = 0;
+    double conversionSeconds = 0;
+};
+
+/*
+Controls which states a sparse (or sorted) register drops to save memory and time. After every gate that can change the size of coefficients, a state is dropped if:
+    * its probability is below threshold (the default only removes rounding noise), or
+    * the register holds more than maxStates states (0 means no limit) and the state is not one of the maxStates most likely ones, or
+    * it is among the least likely states, and dropping it keeps the total probability dropped so far (see PruningStats) within maxPrunedProbability.
+Dropping states leaves the probabilities summing to less than 1. If renormalize is set, the remaining coefficients are scaled back up right away.
+Otherwise they are left as they are, and measurements pick an outcome in proportion to the probability that is left.
+Dense registers store every state anyway, so they are only pruned when they convert back to a sparse representation.
+*/
+struct PruningPolicy {
+    double threshold = 1e-20;
+    long long maxStates = 0;
+    double maxPrunedProbability = 0;
+    bool renormalize = false;
+};
+
+/*
+Counts how many states a register has dropped because of its pruning policy, and their total probability (the truncation error).
+The probability is measured against the state before any pruning: if the policy renormalizes, later drops come out of a state that has already lost
+some of it, so k drops of p_1, ..., p_k of the state at the time add up to 1 - (1 - p_1)...(1 - p_k), which never goes above 1.
+*/
+struct PruningStats {
+    long long prunedStates = 0;
+    double prunedProbability = 0;
+};
+
+// The default control values of the controlled gates (see QuantumRegister::applyUnitary): every control has to be 1.
+const StateIndex ALL_CONTROLS_ONE = ~StateIndex(0);
+
+/*
+Restricts a gate to the states where (state & mask) == value, which is how a register applies controlled gates internally.
+The default (an empty mask) lets the gate act on every state.
+*/
+struct ControlBits {
+    StateIndex mask = 0;
+    StateIndex value = 0;
+};
 
 /*
 Represents a quantum register. In order to use it to simulate quantum computation, one would first initialize a quantum register with n qubits,
@@ -19,25 +100,246 @@ class QuantumRegister{
     private:
     const int numQubits;
 
-    std::unordered_map<int, std::complex<double>> superposition; 
+    Representation representation;
+
+    // Used when the representation is SPARSE.
+    AmplitudeMap superposition;
+
+    /*
+    Sparse gates that move states around build the new superposition here and then swap it with superposition,
+    so the memory of both maps is reused from one gate to the next instead of being allocated for every gate.
+    */
+    AmplitudeMap spareSuperposition;
+
+    // Used when the representation is DENSE. The coefficient of state i is stored at index i.
+    AmplitudeVector amplitudes;
+
+    // Used when the representation is SORTED: the states with a non-zero coefficient, in increasing order. Gates build the new array in spareSortedStates.
+    std::vector<AmplitudeMap::Entry> sortedStates;
+    std::vector<AmplitudeMap::Entry> spareSortedStates;
 
     std::unordered_set<int> measuredQubits;
 
+    AdaptivePolicy adaptivePolicy;
+    RepresentationStats stats;
+
+    PruningPolicy pruningPolicy;
+    PruningStats pruningStats;
+
+    // The total probability of the stored states. This is 1 unless the pruning policy dropped states without renormalizing.
+    double norm = 1;
+
+    // Returns the bits the controls must have for them to take controlValues (see applyUnitary), after checking that they can be used as controls.
+    ControlBits makeControlBits(const std::vector<int>& controls, StateIndex controlValues, const std::vector<int>& qubitsToApply) const;
+
+    /*
+    Applies the pruning policy to a sparse (or sorted) register at the end of a gate. The gate itself already dropped droppedStates states
+    below the threshold, with a total probability of droppedProbability. If checkThreshold is set, the threshold is checked again for every state.
+    */
+    void prune(long long droppedStates, double droppedProbability, bool checkThreshold = false);
+
+    // Shrinks the sparse maps once a measurement or pruning leaves them far emptier than their slots (see AmplitudeMap::shrinkToFit).
+    void shrinkSparseMaps();
+
+    /*
+    Switches representations if the adaptive policy calls for it. The fill ratio of a sparse register is free to compute, but a dense register
+    needs a full pass to count its states, so dense registers are only checked after a measurement (which is what usually makes a state sparse again).
+    */
+    void updateRepresentation(bool afterMeasurement);
+
+    BasisState measureDense(const std::vector<int>& qubitsToMeasure);
+
+    // Returns the probability of every outcome of measuring the given qubits of a dense register (there are 2^qubits.size() of them).
+    std::vector<double> outcomeProbabilitiesDense(const std::vector<int>& qubits);
+
+    /*
+    The gates themselves. Each one only acts on the states selected by controls, and leaves the others as they are, so a controlled gate
+    costs no more than the gate itself (the dense versions never even visit the other states).
+    */
+    void applyControlledUnitary(const Unitary& u, const std::vector<int>& qubitsToApply, const ControlBits& controls);
+    void applyControlledSingleQubitGate(const std::complex<double> (&u)[2][2], int qubit, const ControlBits& controls);
+    void applyControlledBijection(const Bijection& f, const std::vector<int>& qubitsToApply, const ControlBits& controls);
+    void applyControlledRotation(const Rotation& f, const std::vector<int>& qubitsToApply, const ControlBits& controls);
+
+    void applyUnitaryDense(const Unitary& u, const std::vector<int>& qubitsToApply, const ControlBits& controls);
+
+    // Applies a 4x4 matrix (stored row by row) to two qubits of a dense register.
+    void applyTwoQubitGateDense(const std::complex<double>* u, const std::vector<int>& qubitsToApply, const ControlBits& controls = ControlBits());
+
+    /*
+    The general paths of a sparse and a sorted register, which add up the contributions u[i][j] of every state. Gate is Unitary or FixedUnitary,
+    so that fixed-size gates read their entries directly instead of being converted to a Unitary first.
+    */
+    template <typename Gate>
+    void applyUnitarySparse(const Gate& u, const std::vector<int>& qubitsToApply, const ControlBits& controls);
+    template <typename Gate>
+    void applyUnitarySorted(const Gate& u, const std::vector<int>& qubitsToApply, const ControlBits& controls);
+
+    void applySingleQubitGateSorted(const std::complex<double> (&u)[2][2], StateIndex mask, const ControlBits& controls);
+    // Multiplies every state by phases[s], where s is the value of the given qubits.
+    void applyDiagonal(const std::complex<double>* phases, const std::vector<int>& qubitsToApply, const ControlBits& controls = ControlBits());
+    // Sends value s of the given qubits to permutation[s] and multiplies it by phases[s] (see Unitary::getPermutation and getPhases).
+    void applyPermutation(const int* permutation, const std::complex<double>* phases, const std::vector<int>& qubitsToApply, const ControlBits& controls);
+
+    // If this is null, the register uses the process-wide pool (ThreadPool::global).
+    std::shared_ptr<ThreadPool> ownThreadPool;
+    ThreadPool& threadPool();
+
+    /*
+    Calls function(base, length) for every run of consecutive states in a dense register where all of the qubits at the given (increasing) bit positions are 0.
+    The runs are spread over the thread pool. This lets the kernels (see Kernels.hpp) work on long stretches of contiguous memory.
+    With controls, only the runs where the control bits have their required values are visited (base then includes those bits).
+    */
+    template <typename Function>
+    void forEachDenseRun(const std::vector<int>& sortedPositions, Function function, const ControlBits& controls = ControlBits());
+
+    // Calls function(state, coefficient) for every stored state with a non-zero coefficient, one at a time, in whichever representation the register uses.
+    template <typename Function>
+    void forEachStoredState(Function function);
+
+    // Calls function on every (state, coefficient) pair of a sparse (or sorted) register, spreading the work over the thread pool.
+    template <typename Function>
+    void forEachSparseState(Function function);
+
+    /*
+    Moves every state of a sparse (or sorted) register to a new state. remap(s) returns the new value for the given qubits (given their old value s)
+    along with a phase to multiply the coefficient by. remap must be a bijection. States not selected by controls stay where they are.
+    */
+    template <typename Remap>
+    void remapSparseStates(const std::vector<int>& qubits, Remap remap, const ControlBits& controls = ControlBits());
+    void applyBijectionDense(const Bijection& f, const std::vector<int>& qubitsToApply, const ControlBits& controls);
+    void applyRotationDense(const Rotation& f, const std::vector<int>& qubitsToApply, const ControlBits& controls);
+
     public:
+    // Creates a register that starts out sparse and switches representations on its own according to its AdaptivePolicy.
     QuantumRegister(int _qubits);
-    QuantumRegister(int _qubits, std::unordered_map<int, std::complex<double>> _superposition);
 
+    // Creates a register that always uses the given representation (its adaptive policy is disabled).
+    QuantumRegister(int _qubits, Representation _representation);
+
+    QuantumRegister(int _qubits, std::unordered_map<StateIndex, std::complex<double>> _superposition);
+
+    Representation getRepresentation() const;
+
+    /*
+    Converts the register to the given representation. The state itself is left unchanged.
+    If the adaptive policy is enabled, the register may later switch back on its own.
+    */
+    void setRepresentation(Representation newRepresentation);
+
+    const AdaptivePolicy& getAdaptivePolicy() const;
+    void setAdaptivePolicy(const AdaptivePolicy& policy);
+    const RepresentationStats& getStats() const;
+
+    // Setting the pruning policy prunes a sparse register right away.
+    const PruningPolicy& getPruningPolicy() const;
+    void setPruningPolicy(const PruningPolicy& policy);
+    const PruningStats& getPruningStats() const;
+
+    // The fraction of the 2^n basis states with a non-zero coefficient.
+    double fillRatio();
+
+    /*
+    Gives this register its own pool of numThreads threads to apply gates with.
+    By default, registers share the process-wide pool, whose size can be changed with ThreadPool::setGlobalSize.
+    */
+    void setNumThreads(int numThreads);
+    int getNumThreads();
+
+    int getNumQubits() const;
     int numStates();
     
-    std::complex<double> getCoefficient(int state) const;
-    double probability(int state) const;
+    std::complex<double> getCoefficient(StateIndex state) const;
+    double probability(StateIndex state) const;
+
+    // Returns every stored state with its coefficient, in increasing order of state (a dense register leaves out the states below the pruning threshold).
+    std::vector<AmplitudeMap::Entry> getStates() const;
 
     BasisState measure(const std::vector<int>& qubitsToMeasure);
 
+    /*
+    Measures the given qubits separately for every value of groupQubits, as if the states with each value of groupQubits made up a register of their own:
+    each value gets its own outcome, picked with the probabilities of its own states, and its states keep the total probability they had.
+    Returns the outcome for every value of groupQubits (read as an integer, with the first qubit as the most significant bit).
+    groupQubits are left unmeasured. This is how BatchedRegister measures every one of its instances at once.
+    */
+    std::vector<BasisState> measureEach(const std::vector<int>& qubitsToMeasure, const std::vector<int>& groupQubits);
+
+    /*
+    Measures the given qubits shots times without collapsing the register, and returns how many times each outcome came up.
+    An outcome is the value of the measured qubits read as an integer, with the first qubit as the most significant bit (as in BasisState::toInteger).
+    The distribution of the outcomes is only computed once, so this costs one pass over the state plus a binary search per shot,
+    instead of running the whole circuit again for every shot.
+    */
+    std::map<StateIndex, int> sample(const std::vector<int>& qubitsToSample, int shots);
+
+    /*
+    Samples the given qubits shots times separately for every value of groupQubits (as measureEach measures them), without collapsing the register.
+    Returns the histogram of every value of groupQubits, which is empty for a value that holds no states.
+    */
+    std::vector<std::map<StateIndex, int>> sampleEach(const std::vector<int>& qubitsToSample, const std::vector<int>& groupQubits, int shots);
+
     void applyUnitary(const Unitary& u, const std::vector<int>& qubitsToApply);
+
+    /*
+    Applies a one- or two-qubit gate of fixed size (see FixedUnitary.hpp, e.g. Gates::H or Gates::controlledPhase(theta)).
+    These read the entries of the gate directly in every representation, so no Unitary (with its heap-allocated entries) is built for them.
+    */
+    void applyUnitary(const FixedUnitary<1>& u, const std::vector<int>& qubitsToApply);
+    void applyUnitary(const FixedUnitary<2>& u, const std::vector<int>& qubitsToApply);
+
+    /*
+    Applies the 2x2 unitary u to a single qubit. This updates the coefficients in place without going through the general matrix code,
+    and is used automatically by applyUnitary for all single-qubit gates.
+    */
+    void applySingleQubitGate(const std::complex<double> (&u)[2][2], int qubit);
+
     void applyBijection(const Bijection& f, const std::vector<int>& qubitsToApply);
     void applyRotation(const Rotation& f, const std::vector<int>& qubitsToApply);
 
+    /*
+    Controlled versions of the gates above: the gate is applied to qubitsToApply, but only in the states where the control qubits have the values
+    in controlValues, read as an integer with the first control as the most significant bit (as in BasisState::toInteger). By default every control has to be 1.
+    This has the same effect as applying u.controlled() (once for every control) to the controls followed by qubitsToApply, but the larger gate
+    is never built, and the states where the controls do not match are skipped instead of being multiplied by the identity.
+    */
+    void applyUnitary(const Unitary& u, const std::vector<int>& controls, const std::vector<int>& qubitsToApply, StateIndex controlValues = ALL_CONTROLS_ONE);
+    void applyUnitary(const FixedUnitary<1>& u, const std::vector<int>& controls, const std::vector<int>& qubitsToApply, StateIndex controlValues = ALL_CONTROLS_ONE);
+    void applyBijection(const Bijection& f, const std::vector<int>& controls, const std::vector<int>& qubitsToApply, StateIndex controlValues = ALL_CONTROLS_ONE);
+    void applyRotation(const Rotation& f, const std::vector<int>& controls, const std::vector<int>& qubitsToApply, StateIndex controlValues = ALL_CONTROLS_ONE);
+
+    /*
+    Multiplies the value x of qubitsToApply (read as an integer, with the first qubit as the most significant bit) by multiplier modulo modulus, in the states
+    where the controls have the values in controlValues (as above). Values at or above modulus are left as they are. The multiplier must be coprime to the
+    modulus, so that this is a bijection. This is the controlled multiplication of Shor's algorithm: unlike an equivalent Bijection, it needs no table
+    of all 2^m values, and a sparse register only computes the products for the values that occur in its superposition.
+    */
+    void applyModularMultiplication(StateIndex multiplier, StateIndex modulus, const std::vector<int>& controls, const std::vector<int>& qubitsToApply,
+                                    StateIndex controlValues = ALL_CONTROLS_ONE);
+
+    /*
+    Applies the quantum Fourier transform to the wires start to end (both sides inclusive), or its inverse if inverse is set. This is the same transform as
+    the QFT circuit in Algorithms.hpp, with the value of the wires read with start as the most significant bit. Since the wires are contiguous, the transform
+    is a discrete Fourier transform of size 2^m for every value of the other qubits, so a radix-2 FFT on the dense amplitudes does it in O(m 2^n) time,
+    instead of the m^2 / 2 gates (each a pass over the state) of the circuit. A sparse (or sorted) register runs an FFT for every value of the other qubits
+    that occurs in its superposition.
+    */
+    void applyFourierTransform(int start, int end, bool inverse = false);
+
+    /*
+    Exchanges the values of the two wires in each pair (the pairs must not share any wires), in a single pass over the state.
+    Circuit::execute uses this to move qubits in and out of the low bits of the state index (see applyUnitariesBlocked).
+    */
+    void swapQubits(const std::vector<std::pair<int, int>>& pairs);
+
+    /*
+    Applies a sequence of unitaries to a dense register, where gates[k] acts on the wires in qubits[k]. Each wire must be stored in one of the
+    lowest blockQubits bits of the state index, so that every gate maps each block of 2^blockQubits consecutive states to itself.
+    The whole sequence is then applied to one block before moving on to the next, so a block small enough to stay in cache only has to be
+    loaded from memory once instead of once per gate.
+    */
+    void applyUnitariesBlocked(const std::vector<const Unitary*>& gates, const std::vector<std::vector<int>>& qubits, int blockQubits);
+
     friend std::ostream& operator<<(std::ostream& os, const QuantumRegister& qr);
 
     /*
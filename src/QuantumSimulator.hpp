@@ -1,8 +1,12 @@
 #ifndef QUANTUM_SIMULATOR_HPP
 #define QUANTUM_SIMULATOR_HPP
 
+#include "AmplitudeMap.hpp"
 #include "Algorithms.hpp"
 #include "BasisState.hpp"
+#include "BatchedRegister.hpp"
+#include "Circuit.hpp"
+#include "FixedUnitary.hpp"
 #include "Function.hpp"
 #include "Math.hpp"
 #include "QuantumRegister.hpp"
@@ -0,0 +1,80 @@
+#include "QubitGather.hpp"
+#include <cassert>
+#include <algorithm>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define QUBIT_GATHER_X86
+#include <immintrin.h>
+#endif
+
+#ifdef QUBIT_GATHER_X86
+__attribute__((target("bmi2")))
+StateIndex extractBitsBmi2(StateIndex state, StateIndex mask){
+    return _pext_u64(state, mask);
+}
+
+__attribute__((target("bmi2")))
+StateIndex depositBitsBmi2(StateIndex value, StateIndex mask){
+    return _pdep_u64(value, mask);
+}
+
+bool hasBmi2(){
+    static const bool supported = (__builtin_cpu_init(), __builtin_cpu_supports("bmi2"));
+    return supported;
+}
+#else
+StateIndex extractBitsBmi2(StateIndex, StateIndex){
+    assert(false);
+    return 0;
+}
+
+StateIndex depositBitsBmi2(StateIndex, StateIndex){
+    assert(false);
+    return 0;
+}
+
+bool hasBmi2(){
+    return false;
+}
+#endif
+
+QubitGather::QubitGather(const std::vector<int>& qubits, int numQubits): mask(0) {
+    int m = qubits.size();
+    assert(numQubits <= 8 * (int)sizeof(StateIndex));
+
+    // subStateBit[p] is the bit of the sub-state that holds bit p of the state, or -1 if bit p does not hold one of the qubits.
+    std::vector<int> subStateBit(8 * sizeof(StateIndex), -1);
+    bool increasing = true;
+    for(int k = 0; k < m; k++){
+        int position = numQubits - 1 - qubits[k];
+        assert(!(mask & (StateIndex(1) << position)));
+        mask |= StateIndex(1) << position;
+        subStateBit[position] = m - 1 - k;
+        if(k > 0 && qubits[k] <= qubits[k-1]){
+            increasing = false;
+        }
+    }
+    useBmi2 = increasing && hasBmi2();
+    if(useBmi2){
+        return;
+    }
+
+    // Fill the tables one bit at a time: the entry for v is the entry for v without its lowest set bit, plus that bit.
+    numStateBytes = (numQubits + 7) / 8;
+    numSubStateBytes = (m + 7) / 8;
+    for(int b = 0; b < std::max(numStateBytes, numSubStateBytes); b++){
+        extractTable[b][0] = 0;
+        depositTable[b][0] = 0;
+        for(int v = 1; v < 256; v++){
+            int lowest = 0;
+            while(!((v >> lowest) & 1)){
+                lowest++;
+            }
+            int position = 8*b + lowest;
+            StateIndex extracted = subStateBit[position] >= 0 ? StateIndex(1) << subStateBit[position] : 0;
+            StateIndex deposited = position < m ? StateIndex(1) << (numQubits - 1 - qubits[m - 1 - position]) : 0;
+            extractTable[b][v] = extractTable[b][v & (v - 1)] | extracted;
+            depositTable[b][v] = depositTable[b][v & (v - 1)] | deposited;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef QUBIT_GATHER_HPP
+#define QUBIT_GATHER_HPP
+
+#include "BasisState.hpp"
+#include <vector>
+
+// Packs the bits of state selected by mask into the low bits of the result (the PEXT instruction). Only call this if hasBmi2() is true.
+StateIndex extractBitsBmi2(StateIndex state, StateIndex mask);
+
+// The reverse of extractBitsBmi2: spreads the low bits of value out over the bits of mask (the PDEP instruction).
+StateIndex depositBitsBmi2(StateIndex value, StateIndex mask);
+
+// Returns true if the CPU supports the BMI2 instructions (checked once).
+bool hasBmi2();
+
+/*
+Moves the values of a list of qubits between a full state of a register and a sub-state, where value s sets qubits[k] to bit m - 1 - k of s
+(the convention of BasisState). This is built once per gate, so that moving the bits of each state only costs a few instructions
+instead of going through BasisState one qubit at a time.
+If the CPU supports BMI2 and the qubits are in increasing order, the sub-state is simply the bits of the qubits packed together, which PEXT and PDEP do in one instruction.
+Otherwise we look up the contribution of each byte of the state (or sub-state) in a table.
+*/
+class QubitGather{
+    private:
+    StateIndex mask;
+    bool useBmi2;
+
+    // extractTable[b][v] holds the bits of the sub-state set by byte b of a state being v, and depositTable[b][v] the bits of the state set by byte b of a sub-state being v.
+    int numStateBytes;
+    int numSubStateBytes;
+    StateIndex extractTable[sizeof(StateIndex)][256];
+    StateIndex depositTable[sizeof(StateIndex)][256];
+
+    public:
+    QubitGather(const std::vector<int>& qubits, int numQubits);
+
+    // The bits of a state that hold the qubits.
+    StateIndex getMask() const {
+        return mask;
+    }
+
+    // Returns the values of the qubits in state as a sub-state.
+    StateIndex extract(StateIndex state) const {
+        if(useBmi2){
+            return extractBitsBmi2(state, mask);
+        }
+        StateIndex subState = 0;
+        for(int b = 0; b < numStateBytes; b++){
+            subState |= extractTable[b][(state >> (8*b)) & 255];
+        }
+        return subState;
+    }
+
+    // Returns the bits of a state that give the qubits the values in subState (every other bit is 0).
+    StateIndex deposit(StateIndex subState) const {
+        if(useBmi2){
+            return depositBitsBmi2(subState, mask);
+        }
+        StateIndex state = 0;
+        for(int b = 0; b < numSubStateBytes; b++){
+            state |= depositTable[b][(subState >> (8*b)) & 255];
+        }
+        return state;
+    }
+};
+
+#endif
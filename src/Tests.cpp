@@ -1,6 +1,24 @@
 #include "Tests.hpp"
 #include "QuantumSimulator.hpp"
+#include "Kernels.hpp"
+#include "QubitGather.hpp"
 #include <iostream>
+#include <map>
+#include <cassert>
+#include <algorithm>
+
+/*
+Returns the largest difference between the coefficients of two registers of the same size, over every state.
+Most tests run the same gates two ways (e.g. on different representations) and check with this that both ways end up in the same state.
+*/
+double maxCoefficientDifference(const QuantumRegister& a, const QuantumRegister& b){
+    assert(a.getNumQubits() == b.getNumQubits());
+    double maxDifference = 0;
+    for(StateIndex state = 0; state < (StateIndex(1) << a.getNumQubits()); state++){
+        maxDifference = std::max(maxDifference, std::abs(a.getCoefficient(state) - b.getCoefficient(state)));
+    }
+    return maxDifference;
+}
 
 /*
 Tests the quantum teleportation circuit. 
@@ -107,5 +125,1025 @@ void testShor(){
     ShorResult factors = Shor(221, true);
     std::cout << "Shor's algorithm calculated the factors of 221 as " << factors.factor1 << " and " << factors.factor2 << std::endl; 
 
+    std::cout << std::endl;
+}
+
+// Runs the same circuit on a sparse, a dense and a sorted register. All three representations should end up with the same state.
+void testRepresentations(){
+    std::cout << "RUNNING REPRESENTATION TEST..." << std::endl;
+
+    QuantumRegister sparse(6, SPARSE);
+    QuantumRegister dense(6, DENSE);
+    QuantumRegister sorted(6, SORTED);
+    for(QuantumRegister* qr : {&sparse, &dense, &sorted}){
+        qr->applyUnitary(Unitary::X(), {1});
+        for(int i = 0; i < 3; i++){
+            qr->applyUnitary(Unitary::H(), {i});
+        }
+        qr->applyUnitary(Unitary::CNOT(), {0, 4});
+        qr->applyUnitary(Unitary::phase(PI / 3).controlled(), {5, 2});
+        qr->applyUnitary(Unitary::H().tensor(Unitary::SWAP()), {3, 1, 5});
+        // Unlike the gates above, H tensor Y is not equal to its transpose (even up to a phase), so applying it the wrong way around would show.
+        qr->applyUnitary(Unitary::H().tensor(Unitary::Y()), {4, 0});
+        qr->applyBijection(makeBitOracle({0, 1, 1, 0}), {0, 1, 3});
+        qr->applyRotation(makePhaseOracle({0, 1, 0, 0, 1, 0, 0, 1}), {5, 2, 4});
+        QFT(*qr, 0, 5);
+    }
+
+    std::cout << "Largest difference between the sparse and dense coefficients: " << maxCoefficientDifference(sparse, dense) << " (expected: approximately 0)" << std::endl;
+    std::cout << "Largest difference between the sorted and dense coefficients: " << maxCoefficientDifference(sorted, dense) << " (expected: approximately 0)" << std::endl;
+
+    // H tensor Y takes |00> to (|0> + |1>) i|1> / sqrt(2), while its transpose would give -i instead.
+    std::cout << "Coefficient of |01> after H tensor Y on |00>:";
+    for(Representation representation : {SPARSE, DENSE, SORTED}){
+        QuantumRegister qr(2, representation);
+        qr.applyUnitary(Unitary::H().tensor(Unitary::Y()), {0, 1});
+        std::cout << " " << qr.getCoefficient(1);
+    }
+    std::cout << " (expected: (0,0.707107) three times)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Tests that a register switches representations on its own. Applying a Hadamard gate to every qubit fills the whole register, so it should become dense.
+Measuring every qubit leaves a single state, so it should become sparse again.
+*/
+void testAdaptiveRepresentation(){
+    std::cout << "RUNNING ADAPTIVE REPRESENTATION TEST..." << std::endl;
+
+    auto representationToString = [](Representation representation) -> std::string {
+        switch(representation){
+            case SPARSE:
+                return "sparse";
+            case DENSE:
+                return "dense";
+            case SORTED:
+                return "sorted";
+        }
+        return "unknown";
+    };
+
+    QuantumRegister qr(10);
+    for(int i = 0; i < 10; i++){
+        qr.applyUnitary(Unitary::H(), {i});
+    }
+    std::cout << "After the Hadamard transform the register is " << representationToString(qr.getRepresentation()) << " (expected: dense)" << std::endl;
+
+    qr.measure(QuantumRegister::inclusiveRange(0, 9));
+    std::cout << "After measuring the register is " << representationToString(qr.getRepresentation()) << " (expected: sparse)" << std::endl;
+
+    const RepresentationStats& stats = qr.getStats();
+    std::cout << "Conversions: " << stats.sparseToDenseConversions << " to dense and " << stats.denseToSparseConversions << " to sparse (expected: 1 and 1)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Tests that unitaries are classified by their structure. Z and the controlled phase gates only have diagonal entries, X, Y, CNOT and SWAP
+send each state to one other state (Y with a phase), and H mixes states, so it is general.
+*/
+void testUnitaryStructure(){
+    std::cout << "RUNNING UNITARY STRUCTURE TEST..." << std::endl;
+
+    auto structureToString = [](UnitaryStructure structure) -> std::string {
+        switch(structure){
+            case DIAGONAL:
+                return "diagonal";
+            case PERMUTATION:
+                return "permutation";
+            case GENERAL:
+                return "general";
+        }
+        return "unknown";
+    };
+    auto describe = [&structureToString](const std::string& name, const Unitary& u){
+        std::cout << name << " is " << structureToString(u.getStructure());
+        if(u.getStructure() != GENERAL){
+            std::cout << ", sending";
+            for(int j = 0; j < (int)u.size(); j++){
+                std::cout << " " << j << "->" << u.getPermutation()[j] << " " << u.getPhases()[j];
+            }
+        }
+        std::cout << std::endl;
+    };
+
+    describe("Z", Unitary::Z());
+    describe("controlled phase(pi/2)", Unitary::phase(PI / 2).controlled());
+    describe("CZ", Unitary::Z().controlled());
+    std::cout << "(expected: diagonal, with every state sent to itself and phases 1 -1, 1 1 1 i and 1 1 1 -1)" << std::endl;
+    describe("X", Unitary::X());
+    describe("Y", Unitary::Y());
+    describe("CNOT", Unitary::CNOT());
+    describe("SWAP", Unitary::SWAP());
+    std::cout << "(expected: permutation, sending 0->1 1->0 with phases 1 1 for X and i -i for Y, 2->3 3->2 for CNOT and 1->2 2->1 for SWAP)" << std::endl;
+    describe("H", Unitary::H());
+    std::cout << "(expected: general)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+// Runs the same circuit on a dense register with one thread and with four threads. Both should end up with the same state.
+void testMultithreading(){
+    std::cout << "RUNNING MULTITHREADING TEST..." << std::endl;
+
+    int n = 16;
+    QuantumRegister singleThreaded(n, DENSE);
+    QuantumRegister multiThreaded(n, DENSE);
+    singleThreaded.setNumThreads(1);
+    multiThreaded.setNumThreads(4);
+    for(QuantumRegister* qr : {&singleThreaded, &multiThreaded}){
+        for(int i = 0; i < n; i++){
+            qr->applyUnitary(Unitary::H(), {i});
+        }
+        qr->applyRotation(makePhaseOracle(std::vector<bool>(1 << 4, 1)), {3, 7, 11, 15});
+        qr->applyUnitary(Unitary::H().tensor(Unitary::H()), {0, n-1});
+        qr->applyUnitary(Unitary::phase(PI / 5).controlled(), {2, 9});
+        qr->applyBijection(makeBitOracle({0, 1, 1, 0}), {4, 5, 6});
+    }
+
+    std::cout << "Largest difference between the single- and multithreaded coefficients: " << maxCoefficientDifference(singleThreaded, multiThreaded) << " (expected: 0)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Runs every kernel on the same random amplitudes with each instruction set the CPU supports, and checks the vectorized versions against the scalar ones
+(which the kernels would otherwise never use on a CPU with AVX2). The lengths are odd, so the vectorized versions also go through their leftover loops.
+Then the same dense circuit runs with each instruction set.
+*/
+void testKernels(){
+    std::cout << "RUNNING KERNEL TEST..." << std::endl;
+
+    long long length = 37;
+    auto randomAmplitudes = [](long long size){
+        std::vector<std::complex<double>> x(size);
+        for(std::complex<double>& coeff : x){
+            coeff = std::complex<double>(2 * generateRandomDouble() - 1, 2 * generateRandomDouble() - 1);
+        }
+        return x;
+    };
+    std::vector<std::complex<double>> x = randomAmplitudes(8 * length);
+    std::vector<std::complex<double>> z = randomAmplitudes(length);
+    std::vector<std::complex<double>> matrix = randomAmplitudes(64);
+    std::complex<double> u[2][2] = {{matrix[0], matrix[1]}, {matrix[2], matrix[3]}};
+    std::vector<std::uint64_t> offsets = {0, 1, 2, 3, 4, 5, 6, 7};
+    for(std::uint64_t& offset : offsets){
+        offset *= length;
+    }
+    std::vector<std::complex<double>> scratch(4 * 8);
+
+    // Runs every kernel on a copy of x, and returns the copies along with the norm of x.
+    auto runKernels = [&](){
+        std::vector<std::vector<std::complex<double>>> results(7, x);
+        applyPairKernel(results[0].data(), length, length, u);
+        applyAdjacentPairKernel(results[1].data(), length, u);
+        applyMatrixKernel(results[2].data(), length, offsets.data(), 4, matrix.data(), scratch.data());
+        applyMatrixKernel(results[3].data(), length, offsets.data(), 8, matrix.data(), scratch.data());
+        scaleKernel(results[4].data(), length, z[0]);
+        addScaledKernel(results[5].data(), z.data(), length, z[1]);
+        multiplyKernel(results[6].data(), z.data(), length);
+        return std::make_pair(results, normKernel(x.data(), length));
+    };
+    auto runCircuit = [](){
+        QuantumRegister qr(12, DENSE);
+        for(int i = 0; i < 12; i++){
+            qr.applyUnitary(Unitary::H(), {i});
+        }
+        qr.applyUnitary(Unitary::phase(PI / 7).controlled(), {11, 3});
+        qr.applyUnitary(Unitary::H().tensor(Unitary::Y()), {2, 11});
+        qr.applyUnitary(Unitary::H().tensor(Unitary::H()).tensor(Unitary::Y()), {10, 0, 5});
+        qr.applyRotation(makePhaseOracle({0, 1, 1, 0, 1, 0, 0, 1}), {1, 6, 11});
+        QFT(qr, 0, 11);
+        return qr;
+    };
+
+    std::string fastest = kernelInstructionSet();
+    std::vector<std::string> instructionSets = supportedInstructionSets();
+    forceKernelInstructionSet("scalar");
+    auto scalar = runKernels();
+    QuantumRegister scalarRegister = runCircuit();
+    std::cout << "The CPU supports";
+    for(const std::string& instructionSet : instructionSets){
+        std::cout << " " << instructionSet;
+    }
+    std::cout << std::endl;
+    // The last instruction set is the scalar one itself.
+    for(size_t k = 0; k + 1 < instructionSets.size(); k++){
+        forceKernelInstructionSet(instructionSets[k]);
+        auto vectorized = runKernels();
+        double maxDifference = std::abs(vectorized.second - scalar.second);
+        for(size_t kernel = 0; kernel < vectorized.first.size(); kernel++){
+            for(size_t i = 0; i < x.size(); i++){
+                maxDifference = std::max(maxDifference, std::abs(vectorized.first[kernel][i] - scalar.first[kernel][i]));
+            }
+        }
+        std::cout << "Largest difference between the " << kernelInstructionSet() << " and scalar kernels: " << maxDifference
+            << ", and between their circuits: " << maxCoefficientDifference(runCircuit(), scalarRegister) << " (expected: approximately 0)" << std::endl;
+    }
+    forceKernelInstructionSet("");
+    std::cout << "After switching back, the kernels use " << kernelInstructionSet() << " (expected: " << fastest << ")" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Builds the GHZ circuit from the README once and runs it on 10 fresh registers.
+Every run should measure either |000> or |111>.
+*/
+void testCircuit(){
+    std::cout << "RUNNING CIRCUIT TEST..." << std::endl;
+
+    Circuit ghz;
+    ghz.addUnitary(Unitary::H(), {0});
+    ghz.addUnitary(Unitary::CNOT(), {0, 1});
+    ghz.addUnitary(Unitary::CNOT(), {1, 2});
+    ghz.addMeasurement({0, 1, 2});
+
+    std::cout << "Measurements:";
+    for(int shot = 0; shot < 10; shot++){
+        QuantumRegister qr(3);
+        std::cout << " " << ghz.execute(qr)[0];
+    }
+    std::cout << " (expected: only |000> and |111>)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Runs the QFT circuit on a register in a random-looking state, once as it is and once after fusing its gates.
+Both registers should end up in the same state, while the fused circuit has fewer operations, none wider than the limit.
+Then fuses a small circuit whose gates fall into two known blocks.
+*/
+void testFusion(){
+    std::cout << "RUNNING FUSION TEST..." << std::endl;
+
+    int n = 8;
+    Circuit qft = makeQFTCircuit(0, n-1);
+    Circuit fused = qft.fused();
+
+    QuantumRegister original(n, DENSE);
+    QuantumRegister fusedRegister(n, DENSE);
+    for(QuantumRegister* qr : {&original, &fusedRegister}){
+        for(int i = 0; i < n; i++){
+            qr->applyUnitary(Unitary::H(), {i});
+        }
+        qr->applyRotation(makePhaseOracle({1, 0, 0, 1, 0, 1, 1, 1}), {1, 4, 6});
+    }
+    qft.execute(original);
+    fused.execute(fusedRegister);
+
+    int widest = 0;
+    for(const Circuit::Operation& operation : fused.getOperations()){
+        widest = std::max(widest, operation.qubitCount);
+    }
+    std::cout << "The fused circuit has " << fused.size() << " operations instead of " << qft.size() << ", the widest on " << widest << " qubits (expected: at most 4)" << std::endl;
+    std::cout << "Largest difference between the fused and unfused coefficients: " << maxCoefficientDifference(original, fusedRegister) << " (expected: approximately 0)" << std::endl;
+
+    // With at most 2 qubits per gate, the gates on qubits 0 and 1 become one gate, and the gates on qubits 2 and 3 another.
+    Circuit pairs;
+    pairs.addUnitary(Gates::H, {0});
+    pairs.addUnitary(Gates::H, {1});
+    pairs.addUnitary(Gates::CNOT, {0, 1});
+    pairs.addUnitary(Gates::T, {1});
+    pairs.addUnitary(Gates::H, {2});
+    pairs.addUnitary(Gates::CNOT, {2, 3});
+    Circuit fusedPairs = pairs.fused(2);
+    std::cout << "Fusing 6 gates on two pairs of qubits gave " << fusedPairs.size() << " operations, on the qubits";
+    for(const Circuit::Operation& operation : fusedPairs.getOperations()){
+        std::cout << " {";
+        for(int qubit : fusedPairs.getQubits(operation)){
+            std::cout << " " << qubit;
+        }
+        std::cout << " }";
+    }
+    std::cout << " (expected: 2 operations, on { 0 1 } and { 2 3 })" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Runs the same circuit on two dense registers, once applying every gate on its own and once in cache-sized blocks of 2^4 states.
+The blocked run has to swap the high qubits into the low bits of the state index and back, and should still end up in the same state.
+*/
+void testBlockedExecution(){
+    std::cout << "RUNNING BLOCKED EXECUTION TEST..." << std::endl;
+
+    int n = 10;
+    Circuit circuit;
+    for(int i = 0; i < n; i++){
+        circuit.addUnitary(Unitary::H(), {i});
+    }
+    circuit.addRotation(makePhaseOracle({1, 0, 0, 1, 0, 1, 1, 1}), {0, 5, 9});
+    circuit.addUnitary(Unitary::CNOT(), {1, 8});
+    circuit.append(makeIQFTCircuit(0, n-1));
+
+    QuantumRegister unblocked(n, DENSE);
+    QuantumRegister blocked(n, DENSE);
+    circuit.execute(unblocked, 0);
+    circuit.execute(blocked, 4);
+
+    std::cout << "Largest difference between the blocked and unblocked coefficients: " << maxCoefficientDifference(unblocked, blocked) << " (expected: approximately 0)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Checks QubitGather against BasisState, which reads and writes one qubit at a time. Half of the qubit lists are shuffled, which goes through the byte tables,
+and the other half are in increasing order, which uses PEXT and PDEP if the CPU has BMI2 (and the tables otherwise). The lists have 12 of 40 qubits,
+so both the states and the sub-states span more than one byte of the tables.
+*/
+void testQubitGather(){
+    std::cout << "RUNNING QUBIT GATHER TEST..." << std::endl;
+
+    int n = 40;
+    int m = 12;
+    auto randomState = [n](){
+        return (((StateIndex)generateRandomInt(0, (1 << 20) - 1) << 20) | generateRandomInt(0, (1 << 20) - 1)) & ((StateIndex(1) << n) - 1);
+    };
+
+    int mismatches = 0;
+    for(int trial = 0; trial < 20; trial++){
+        // Pick m distinct qubits in a random order.
+        std::vector<int> qubits = QuantumRegister::inclusiveRange(0, n - 1);
+        for(int k = 0; k < m; k++){
+            std::swap(qubits[k], qubits[generateRandomInt(k, n - 1)]);
+        }
+        qubits.resize(m);
+        if(trial % 2 == 1){
+            std::sort(qubits.begin(), qubits.end());
+        }
+
+        QubitGather gather(qubits, n);
+        for(int sample = 0; sample < 1000; sample++){
+            StateIndex state = randomState();
+            BasisState basisState(state, n);
+            StateIndex subState = state & ((StateIndex(1) << m) - 1);
+            BasisState deposited(gather.deposit(subState), n);
+            BasisState expectedDeposit(0, n);
+            StateIndex expectedExtract = 0;
+            for(int k = 0; k < m; k++){
+                expectedExtract |= (StateIndex)basisState.getQubit(qubits[k]) << (m - 1 - k);
+                expectedDeposit.setQubit(qubits[k], (subState >> (m - 1 - k)) & 1);
+            }
+            mismatches += gather.extract(state) != expectedExtract;
+            mismatches += deposited.toInteger() != expectedDeposit.toInteger();
+        }
+    }
+    std::cout << "BMI2 is " << (hasBmi2() ? "supported" : "not supported") << ", and " << mismatches << " of 40000 extracted and deposited values differ from BasisState (expected: 0)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Prepares a GHZ state on 60 qubits, which only works because the sparse representation stores 2 states instead of 2^60.
+Measuring every qubit should give either all 0s or all 1s.
+*/
+void testLargeRegister(){
+    std::cout << "RUNNING LARGE REGISTER TEST..." << std::endl;
+
+    int n = 60;
+    QuantumRegister qr(n);
+    qr.applyUnitary(Unitary::H(), {0});
+    for(int i = 1; i < n; i++){
+        qr.applyUnitary(Unitary::CNOT(), {i-1, i});
+    }
+    std::cout << "The register holds " << qr.numStates() << " states (expected: 2)" << std::endl;
+
+    BasisState output = qr.measure(QuantumRegister::inclusiveRange(0, n-1));
+    StateIndex allOnes = ~StateIndex(0) >> (64 - n);
+    std::cout << "Measured all " << (output.toInteger() == allOnes ? "1s" : output.toInteger() == 0 ? "0s" : "mixed") << " (expected: all 0s or all 1s)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Tests the hash map used by sparse registers, by making the same random insertions and deletions in it and in a std::map.
+Many of the states share their low bits, so a lot of them collide and get moved around by insertions and deletions.
+*/
+void testAmplitudeMap(){
+    std::cout << "RUNNING AMPLITUDE MAP TEST..." << std::endl;
+
+    AmplitudeMap map;
+    std::map<StateIndex, std::complex<double>> expected;
+    for(int i = 0; i < 100000; i++){
+        StateIndex state = (StateIndex)generateRandomInt(0, 4095) << 52 | generateRandomInt(0, 3);
+        if(generateRandomDouble() < 0.3){
+            map.erase(state);
+            expected.erase(state);
+        }
+        else{
+            map[state] += i;
+            expected[state] += i;
+        }
+    }
+
+    int mismatches = map.size() != expected.size();
+    for(const auto& entry : expected){
+        const std::complex<double>* coeff = map.find(entry.first);
+        mismatches += !coeff || *coeff != entry.second;
+    }
+    std::cout << "The map holds " << map.size() << " states, with " << mismatches << " mismatches (expected: 0)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Measures 14 of 16 qubits of an entangled state in every representation. That is more outcomes than a dense register counts one by one,
+so it picks a single state instead. The first list of qubits includes the last qubit (the lowest bit of the state) and the second does not,
+which covers both kinds of runs. Afterwards every state left should agree with the outcome, and their probabilities should sum to 1.
+*/
+void testLargeMeasurement(){
+    std::cout << "RUNNING LARGE MEASUREMENT TEST..." << std::endl;
+
+    int n = 16;
+    std::vector<std::vector<int>> measuredLists = {{15, 3, 0, 7, 12, 1, 9, 4, 14, 2, 11, 6, 13, 8}, {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13}};
+    for(const std::vector<int>& measured : measuredLists){
+        for(const std::pair<Representation, const char*>& representation : {std::make_pair(SPARSE, "sparse"), std::make_pair(DENSE, "dense"), std::make_pair(SORTED, "sorted")}){
+            QuantumRegister qr(n, representation.first);
+            for(int i = 0; i < n; i++){
+                qr.applyUnitary(Unitary::H(), {i});
+            }
+            for(int i = 0; i + 1 < n; i++){
+                qr.applyUnitary(Unitary::phase(PI / (i + 2)).controlled(), {i, i + 1});
+            }
+            qr.applyUnitary(Unitary::H().tensor(Unitary::Y()), {5, 10});
+            qr.applyUnitary(Unitary::CNOT(), {15, 0});
+
+            BasisState outcome = qr.measure(measured);
+            double totalProbability = 0;
+            int disagreeing = 0;
+            for(StateIndex state = 0; state < (StateIndex(1) << n); state++){
+                double probability = qr.probability(state);
+                totalProbability += probability;
+                BasisState basisState(state, n);
+                for(int k = 0; k < (int)measured.size() && probability > 0; k++){
+                    if(basisState.getQubit(measured[k]) != outcome.getQubit(k)){
+                        disagreeing++;
+                        break;
+                    }
+                }
+            }
+            std::cout << "After measuring " << measured.size() << " qubits of the " << representation.second << " register, " << disagreeing << " states disagree with the outcome and the probabilities sum to "
+                << totalProbability << " (expected: 0 and 1)" << std::endl;
+        }
+    }
+
+    std::cout << std::endl;
+}
+
+/*
+Samples two qubits of a state (in every representation) where the outcomes 0, 1, 2 and 3 have probabilities 0.1, 0.2, 0.3 and 0.4.
+Sampling must not collapse the register, so it should still hold all of its states afterwards.
+*/
+void testSample(){
+    std::cout << "RUNNING SAMPLE TEST..." << std::endl;
+
+    const char* names[] = {"sparse", "dense", "sorted"};
+    for(Representation representation : {SPARSE, DENSE, SORTED}){
+        QuantumRegister qr(3, {{0b000, sqrt(0.1)}, {0b011, sqrt(0.2)}, {0b110, sqrt(0.3)}, {0b111, sqrt(0.4)}});
+        AdaptivePolicy policy;
+        policy.enabled = false;
+        qr.setAdaptivePolicy(policy);
+        qr.setRepresentation(representation);
+
+        int shots = 100000;
+        std::map<StateIndex, int> histogram = qr.sample({0, 2}, shots);
+        std::cout << "Sampled from the " << names[representation] << " register:";
+        for(StateIndex outcome = 0; outcome < 4; outcome++){
+            std::cout << " " << (double)histogram[outcome] / shots;
+        }
+        std::cout << " (expected: approximately 0.1 0.2 0.3 0.4), " << qr.numStates() << " states left (expected: 4)" << std::endl;
+    }
+
+    std::cout << std::endl;
+}
+
+/*
+Rotates every qubit of a register a little, which spreads it over all 2^8 states but leaves most of the probability on a few of them.
+A register that keeps at most 16 states (and renormalizes) should end up with 16 states summing to probability 1, and a register with a budget
+should drop at most that much probability, where the probability that is left plus the reported truncation error should still add up to 1.
+*/
+void testPruning(){
+    std::cout << "RUNNING PRUNING TEST..." << std::endl;
+
+    int n = 8;
+    Unitary rotation({{cos(0.3), -sin(0.3)}, {sin(0.3), cos(0.3)}});
+    auto totalProbability = [n](const QuantumRegister& qr){
+        double total = 0;
+        for(StateIndex state = 0; state < (StateIndex(1) << n); state++){
+            total += qr.probability(state);
+        }
+        return total;
+    };
+
+    const char* names[] = {"sparse", "dense", "sorted"};
+    for(Representation representation : {SPARSE, SORTED}){
+        QuantumRegister capped(n, representation);
+        PruningPolicy policy;
+        policy.maxStates = 16;
+        policy.renormalize = true;
+        capped.setPruningPolicy(policy);
+
+        QuantumRegister budgeted(n, representation);
+        policy = PruningPolicy();
+        policy.maxPrunedProbability = 0.01;
+        budgeted.setPruningPolicy(policy);
+
+        for(int i = 0; i < n; i++){
+            capped.applyUnitary(rotation, {i});
+            budgeted.applyUnitary(rotation, {i});
+        }
+
+        std::cout << "The capped " << names[representation] << " register holds " << capped.numStates() << " states (expected: 16) with total probability "
+            << totalProbability(capped) << " (expected: 1), after dropping " << capped.getPruningStats().prunedProbability << std::endl;
+        const PruningStats& stats = budgeted.getPruningStats();
+        std::cout << "The budgeted " << names[representation] << " register dropped " << stats.prunedStates << " states with probability " << stats.prunedProbability
+            << " (expected: at most 0.01), which adds up to " << totalProbability(budgeted) + stats.prunedProbability << " with the rest (expected: 1)" << std::endl;
+
+        /*
+        Renormalizing scales the states back up after every drop, so each later drop is a share of what is left rather than of the original state.
+        With a tight cap, a layer of Hadamard gates after the rotations drops most of the probability again and again, but the total stays below 1.
+        */
+        policy = PruningPolicy();
+        policy.maxStates = 10;
+        policy.renormalize = true;
+        QuantumRegister renormalized(n, representation);
+        renormalized.setPruningPolicy(policy);
+        policy.maxStates = 0;
+        policy.maxPrunedProbability = 0.05;
+        QuantumRegister renormalizedBudget(n, representation);
+        renormalizedBudget.setPruningPolicy(policy);
+        for(QuantumRegister* qr : {&renormalized, &renormalizedBudget}){
+            for(int i = 0; i < n; i++){
+                qr->applyUnitary(rotation, {i});
+            }
+            for(int i = 0; i < n; i++){
+                qr->applyUnitary(Unitary::H(), {i});
+            }
+        }
+        std::cout << "The renormalized " << names[representation] << " registers dropped probability " << renormalized.getPruningStats().prunedProbability
+            << " (expected: at most 1) with a cap, and " << renormalizedBudget.getPruningStats().prunedProbability << " (expected: at most 0.05) with a budget,"
+            << " leaving total probability " << totalProbability(renormalizedBudget) << " (expected: 1)" << std::endl;
+    }
+
+    std::cout << std::endl;
+}
+
+/*
+Applies the same gates to two registers of each representation, once as FixedUnitary constants and once as Unitary objects.
+The two registers should end up in the same state.
+*/
+void testFixedUnitary(){
+    std::cout << "RUNNING FIXED UNITARY TEST..." << std::endl;
+
+    // The standard gates are compile-time constants.
+    static_assert(Gates::CNOT[3][2] == 1.0 && Gates::CNOT[2][2] == 0.0, "CNOT should swap the last two states");
+
+    double maxDifference = 0;
+    for(Representation representation : {SPARSE, DENSE, SORTED}){
+        QuantumRegister fixed(5, representation);
+        QuantumRegister dynamic(5, representation);
+        for(int i = 0; i < 5; i++){
+            fixed.applyUnitary(Gates::H, {i});
+            dynamic.applyUnitary(Unitary::H(), {i});
+        }
+        fixed.applyUnitary(Gates::CNOT, {0, 3});
+        dynamic.applyUnitary(Unitary::CNOT(), {0, 3});
+        fixed.applyUnitary(Gates::controlledPhase(PI / 5), {4, 1});
+        dynamic.applyUnitary(Unitary::phase(PI / 5).controlled(), {4, 1});
+        fixed.applyUnitary(Gates::H.tensor(Gates::Y), {2, 0});
+        dynamic.applyUnitary(Unitary::H().tensor(Unitary::Y()), {2, 0});
+        fixed.applyUnitary((Gates::X * Gates::Z).controlled(), {3, 4});
+        dynamic.applyUnitary((Unitary::X() * Unitary::Z()).controlled(), {3, 4});
+        fixed.applyUnitary(Gates::SWAP, {1, 2});
+        dynamic.applyUnitary(Unitary::SWAP(), {1, 2});
+        fixed.applyUnitary(Gates::Y.tensor(Gates::S), {0, 4});
+        dynamic.applyUnitary(Unitary::Y().tensor(Unitary::phase(PI / 2)), {0, 4});
+        fixed.applyUnitary(Gates::T.tensor(Gates::H), {3, 2});
+        dynamic.applyUnitary(Gates::T.tensor(Gates::H).toUnitary(), {3, 2});
+
+        maxDifference = std::max(maxDifference, maxCoefficientDifference(fixed, dynamic));
+    }
+    std::cout << "Largest difference between the fixed and dynamic gates: " << maxDifference << " (expected: approximately 0)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Checks the matrix operations of Unitary on 7-qubit matrices, which span more than one 64 x 64 tile of the blocked product.
+The product is compared with a plain triple loop, the adjoint has to undo the product, and the versions for temporaries have to agree with the others.
+*/
+void testMatrixOperations(){
+    std::cout << "RUNNING MATRIX OPERATIONS TEST..." << std::endl;
+
+    // A tensor product of random single-qubit unitaries, so that every entry is non-zero.
+    auto randomUnitary = [](int numQubits){
+        Unitary u = Unitary::identity(1);
+        for(int k = 0; k < numQubits; k++){
+            double theta = PI * generateRandomDouble();
+            std::complex<double> a = std::polar(cos(theta), 2 * PI * generateRandomDouble());
+            std::complex<double> b = std::polar(sin(theta), 2 * PI * generateRandomDouble());
+            u = u.tensor(Unitary({{a, -std::conj(b)}, {b, std::conj(a)}}));
+        }
+        return u;
+    };
+    Unitary a = randomUnitary(7);
+    Unitary b = randomUnitary(4).tensor(Unitary::CNOT()).tensor(Unitary::H());
+    int size = a.size();
+
+    Unitary product = a * b;
+    double productDifference = 0;
+    for(int i = 0; i < size; i++){
+        for(int j = 0; j < size; j++){
+            std::complex<double> sum = 0;
+            for(int k = 0; k < size; k++){
+                sum += a[i][k] * b[k][j];
+            }
+            productDifference = std::max(productDifference, std::abs(product[i][j] - sum));
+        }
+    }
+
+    Unitary inverse = product.adjoint() * product;
+    double identityDifference = 0;
+    for(int i = 0; i < size; i++){
+        for(int j = 0; j < size; j++){
+            identityDifference = std::max(identityDifference, std::abs(inverse[i][j] - (i == j ? 1.0 : 0.0)));
+        }
+    }
+
+    // The same operations on a temporary, which reuse its buffer, against the same operations on a copy that is kept.
+    std::complex<double> z(0.6, 0.8);
+    std::vector<std::pair<Unitary, Unitary>> versions = {
+        {(a * b).adjoint(), product.adjoint()},
+        {(a * b).conjugate().transpose(), product.adjoint()},
+        {-(a * b) * z, -product * z},
+        {z * (a * b), z * product}
+    };
+    double temporaryDifference = 0;
+    for(const std::pair<Unitary, Unitary>& version : versions){
+        for(int i = 0; i < size; i++){
+            for(int j = 0; j < size; j++){
+                temporaryDifference = std::max(temporaryDifference, std::abs(version.first[i][j] - version.second[i][j]));
+            }
+        }
+    }
+
+    // Entry (i, j) of a tensor product is the product of the entries of its factors.
+    Unitary small = randomUnitary(3);
+    Unitary tensored = small.tensor(b);
+    double tensorDifference = 0;
+    for(int i = 0; i < tensored.size(); i++){
+        for(int j = 0; j < tensored.size(); j++){
+            tensorDifference = std::max(tensorDifference, std::abs(tensored[i][j] - small[i / size][j / size] * b[i % size][j % size]));
+        }
+    }
+
+    std::cout << "Largest difference from the triple loop: " << productDifference << ", of the adjoint times the product from the identity: " << identityDifference << std::endl;
+    std::cout << "Largest difference between temporaries and copies: " << temporaryDifference << ", of the tensor product from its factors: " << tensorDifference << std::endl;
+    std::cout << "(expected: approximately 0 for all four)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Applies the same gates to two registers of each representation, once with lists of control qubits and once as the larger controlled gates
+(with X gates around the controls that have to be 0). The two registers should end up in the same state.
+*/
+void testControlledGates(){
+    std::cout << "RUNNING CONTROLLED GATES TEST..." << std::endl;
+
+    Unitary wide = Unitary::H().tensor(Unitary::H()).tensor(Unitary::Y());
+    Unitary pair = Unitary::H().tensor(Unitary::phase(PI / 3));
+    Bijection increment({1, 2, 3, 0});
+    Rotation oracle = makePhaseOracle({0, 1, 1, 0});
+
+    double maxDifference = 0;
+    for(Representation representation : {SPARSE, DENSE, SORTED}){
+        QuantumRegister controlled(6, representation);
+        QuantumRegister expanded(6, representation);
+        for(int i = 0; i < 6; i++){
+            controlled.applyUnitary(Gates::H, {i});
+            expanded.applyUnitary(Gates::H, {i});
+        }
+
+        // A Toffoli gate.
+        controlled.applyUnitary(Gates::X, {0, 1}, {5});
+        expanded.applyUnitary(Unitary::X().controlled().controlled(), {0, 1, 5});
+
+        // Qubit 2 has to be 1 and qubit 3 has to be 0.
+        controlled.applyUnitary(pair, {2, 3}, {4, 1}, 0b10);
+        expanded.applyUnitary(Unitary::X(), {3});
+        expanded.applyUnitary(pair.controlled().controlled(), {2, 3, 4, 1});
+        expanded.applyUnitary(Unitary::X(), {3});
+
+        controlled.applyBijection(increment, {0}, {4, 5});
+        expanded.applyBijection(increment.controlled(), {0, 4, 5});
+
+        controlled.applyRotation(oracle, {3, 5}, {1, 2}, 0b01);
+        expanded.applyUnitary(Unitary::X(), {3});
+        expanded.applyRotation(oracle.controlled().controlled(), {3, 5, 1, 2});
+        expanded.applyUnitary(Unitary::X(), {3});
+
+        controlled.applyUnitary(Unitary::phase(PI / 7), {4}, {0});
+        expanded.applyUnitary(Unitary::phase(PI / 7).controlled(), {4, 0});
+
+        controlled.applyUnitary(wide, {0}, {1, 3, 5});
+        expanded.applyUnitary(wide.controlled(), {0, 1, 3, 5});
+
+        maxDifference = std::max(maxDifference, maxCoefficientDifference(controlled, expanded));
+    }
+    std::cout << "Largest difference between the controlled and expanded gates: " << maxDifference << " (expected: approximately 0)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Tests bijections and rotations given as functions instead of tables. The function versions should match the tables on every representation,
+and a sparse register should be able to apply an oracle on 36 qubits, whose table would not fit in memory.
+*/
+void testCallableOracles(){
+    std::cout << "RUNNING CALLABLE ORACLES TEST..." << std::endl;
+
+    Bijection tableBijection({3, 6, 1, 4, 7, 2, 5, 0});
+    Bijection functionBijection(8, [](StateIndex x){
+        return (3 * x + 3) % 8;
+    });
+    Rotation tableRotation({1, -1, std::complex<double>(0, 1), 1});
+    Rotation functionRotation(4, [](StateIndex x){
+        return x == 1 ? std::complex<double>(-1) : x == 2 ? std::complex<double>(0, 1) : std::complex<double>(1);
+    });
+
+    double maxDifference = 0;
+    for(Representation representation : {SPARSE, DENSE, SORTED}){
+        QuantumRegister table(5, representation);
+        QuantumRegister function(5, representation);
+        for(QuantumRegister* qr : {&table, &function}){
+            for(int i = 0; i < 5; i++){
+                qr->applyUnitary(Gates::H, {i});
+            }
+            qr->applyUnitary(Gates::T, {2});
+            qr->applyUnitary(Gates::S, {4});
+        }
+        table.applyBijection(tableBijection, {4, 0, 2});
+        function.applyBijection(functionBijection, {4, 0, 2});
+        table.applyRotation(tableRotation.controlled(), {1, 3, 0});
+        function.applyRotation(functionRotation.controlled(), {1, 3, 0});
+
+        maxDifference = std::max(maxDifference, maxCoefficientDifference(table, function));
+    }
+    std::cout << "Largest difference between the table and function oracles: " << maxDifference << " (expected: approximately 0)" << std::endl;
+
+    // A dense register looks up every value of the qubits once, so the function is called once per value.
+    int calls = 0;
+    QuantumRegister dense(6, DENSE);
+    dense.applyRotation(Rotation(16, [&calls](StateIndex x){
+        calls++;
+        return x % 3 == 0 ? std::complex<double>(-1) : std::complex<double>(1);
+    }), {5, 1, 3, 0});
+    std::cout << "The rotation function was called " << calls << " times on the dense register (expected: 16)" << std::endl;
+
+    // Add 12345 to the last 36 qubits (modulo 2^36), for each of the 16 values of the first 4.
+    QuantumRegister wide(40);
+    for(int i = 0; i < 4; i++){
+        wide.applyUnitary(Gates::H, {i});
+    }
+    StateIndex mask = (StateIndex(1) << 36) - 1;
+    wide.applyBijection(Bijection(StateIndex(1) << 36, [mask](StateIndex x){
+        return (x + 12345) & mask;
+    }), QuantumRegister::inclusiveRange(4, 39));
+    double probability = 0;
+    for(StateIndex x = 0; x < 16; x++){
+        probability += wide.probability((x << 36) | 12345);
+    }
+    std::cout << "The wide register holds " << wide.numStates() << " states (expected: 16), with total probability " << probability << " on the shifted states (expected: 1)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Multiplies a 4-qubit value by 7 modulo 15 (controlled by another qubit) with applyModularMultiplication, and with the equivalent controlled bijection.
+The two registers should end up in the same state on every representation. Then checks the products of a few single values.
+*/
+void testModularMultiplication(){
+    std::cout << "RUNNING MODULAR MULTIPLICATION TEST..." << std::endl;
+
+    std::vector<StateIndex> table(16);
+    for(StateIndex x = 0; x < 16; x++){
+        table[x] = x < 15 ? (7 * x) % 15 : x;
+    }
+    Bijection bijection(table);
+
+    double maxDifference = 0;
+    for(Representation representation : {SPARSE, DENSE, SORTED}){
+        QuantumRegister multiplied(6, representation);
+        QuantumRegister permuted(6, representation);
+        for(QuantumRegister* qr : {&multiplied, &permuted}){
+            for(int i = 0; i < 6; i++){
+                qr->applyUnitary(Gates::H, {i});
+            }
+            qr->applyUnitary(Gates::T, {3});
+            qr->applyUnitary(Gates::S, {5});
+        }
+        multiplied.applyModularMultiplication(7, 15, {1}, {5, 0, 3, 2});
+        permuted.applyBijection(bijection, {1}, {5, 0, 3, 2});
+
+        maxDifference = std::max(maxDifference, maxCoefficientDifference(multiplied, permuted));
+    }
+    std::cout << "Largest difference between the multiplication and the bijection: " << maxDifference << " (expected: approximately 0)" << std::endl;
+
+    // Multiply single values on qubits 1 to 4, with qubit 0 as the control. Values from the modulus up, and values whose control is 0, stay as they are.
+    std::cout << "7x mod 15 gave:";
+    for(std::pair<StateIndex, StateIndex> input : std::vector<std::pair<StateIndex, StateIndex>>{{1, 4}, {1, 11}, {1, 15}, {0, 4}}){
+        QuantumRegister qr(5);
+        StateIndex state = input.first << 4 | input.second;
+        for(int i = 0; i < 5; i++){
+            if((state >> (4 - i)) & 1){
+                qr.applyUnitary(Gates::X, {i});
+            }
+        }
+        qr.applyModularMultiplication(7, 15, {0}, {1, 2, 3, 4});
+        std::cout << " " << qr.measure({1, 2, 3, 4}).toInteger();
+    }
+    std::cout << " (expected: 13 2 15 4)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Checks the closed form used by the structured mode of Shor's algorithm against the inverse QFT circuit on a comb, and then factors a larger number with it.
+*/
+void testStructuredShor(){
+    std::cout << "RUNNING STRUCTURED SHOR TEST..." << std::endl;
+
+    // The values 5, 17, 29, ..., 245 of 8 qubits (21 values spaced 12 apart).
+    std::unordered_map<StateIndex, std::complex<double>> comb;
+    for(StateIndex x = 5; x < 256; x += 12){
+        comb[x] = 1 / std::sqrt(21.0);
+    }
+    QuantumRegister qr(8, comb);
+    IQFT(qr, 0, 7);
+    double maxDifference = 0;
+    for(StateIndex y = 0; y < 256; y++){
+        maxDifference = std::max(maxDifference, std::abs(qr.probability(y) - combIQFTProbability(y, 12, 21, 8)));
+    }
+    std::cout << "Largest difference between the circuit and the closed form: " << maxDifference << " (expected: approximately 0)" << std::endl;
+
+    ShorResult factors = Shor(1007, false, STRUCTURED);
+    std::cout << "The structured mode calculated the factors of 1007 as " << factors.factor1 << " and " << factors.factor2 << " (expected: 19 and 53 in some order)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Applies the same QFTs and IQFTs to three registers, once with the gate-level circuits and twice with the FFT (on a dense and on a sparse register).
+The ranges are chosen so that the dense FFT transforms columns of different lengths (the wires at the start, in the middle and at the end of the register),
+and some of its stages run outside of the cache-sized blocks. All three registers should end up in the same state.
+*/
+void testFFTQFT(){
+    std::cout << "RUNNING FFT QFT TEST..." << std::endl;
+
+    int n = 16;
+    QuantumRegister gates(n, DENSE);
+    QuantumRegister dense(n, DENSE);
+    QuantumRegister sparse(n, SPARSE);
+    for(QuantumRegister* qr : {&gates, &dense, &sparse}){
+        for(int i = 0; i < n; i += 2){
+            qr->applyUnitary(Gates::H, {i});
+        }
+        qr->applyUnitary(Gates::CNOT, {2, 11});
+        qr->applyRotation(makePhaseOracle({1, 0, 0, 1, 0, 1, 1, 1}), {1, 4, 15});
+    }
+
+    QFT(gates, 0, 7);
+    IQFT(gates, 5, 15);
+    QFT(gates, 0, n-1);
+    for(QuantumRegister* qr : {&dense, &sparse}){
+        QFT(*qr, 0, 7, FFT);
+        IQFT(*qr, 5, 15, FFT);
+        QFT(*qr, 0, n-1, FFT);
+    }
+
+    std::cout << "Largest difference between the gate-level and FFT coefficients: " << maxCoefficientDifference(gates, dense) << " (dense), "
+        << maxCoefficientDifference(gates, sparse) << " (sparse) (expected: approximately 0 for both)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Applies the exact and an approximate inverse QFT to the same state, and checks that the approximate circuit drops the expected rotations
+and that the fidelity lost is within the bound of approximateQFTFidelityLoss.
+Then factors 221 with an approximate inverse QFT in Shor's algorithm.
+*/
+void testApproximateQFT(){
+    std::cout << "RUNNING APPROXIMATE QFT TEST..." << std::endl;
+
+    int n = 10, degree = 6;
+    QuantumRegister exact(n, DENSE);
+    QuantumRegister approximate(n, DENSE);
+    for(QuantumRegister* qr : {&exact, &approximate}){
+        for(int i = 0; i < n; i++){
+            qr->applyUnitary(Gates::H, {i});
+        }
+        qr->applyRotation(makePhaseOracle({1, 0, 0, 1, 0, 1, 1, 1}), {0, 4, 7});
+        qr->applyUnitary(Gates::T, {9});
+    }
+    IQFT(exact, 0, n-1);
+    IQFT(approximate, 0, n-1, GATES, degree);
+
+    std::complex<double> overlap = 0;
+    for(int state = 0; state < (1 << n); state++){
+        overlap += std::conj(exact.getCoefficient(state)) * approximate.getCoefficient(state);
+    }
+    // The rotations by 2 pi / 2^k with k > degree are dropped, and there are n - k + 1 of them for each k.
+    int dropped = 0;
+    for(int k = degree + 1; k <= n; k++){
+        dropped += n - k + 1;
+    }
+    std::cout << "The approximate circuit has " << makeIQFTCircuit(0, n-1, degree).size() << " operations instead of " << makeIQFTCircuit(0, n-1).size()
+        << " (expected: " << makeIQFTCircuit(0, n-1).size() - dropped << ")" << std::endl;
+
+    double lost = 1 - std::norm(overlap);
+    double bound = approximateQFTFidelityLoss(n, degree);
+    std::cout << "Fidelity lost: " << lost << ", bound: " << bound << ", lost more than 0 and at most the bound: " << (lost > 0 && lost <= bound ? "yes" : "no")
+        << " (expected: yes)" << std::endl;
+    std::cout << "Bound for the exact transform: " << approximateQFTFidelityLoss(n, 0) << " (expected: 0)" << std::endl;
+
+    ShorResult factors = Shor(221, false, GATE_LEVEL, 8);
+    std::cout << "With an approximate inverse QFT, Shor's algorithm calculated the factors of 221 as " << factors.factor1 << " and " << factors.factor2
+        << " (expected: 13 and 17 in some order)" << std::endl;
+
+    std::cout << std::endl;
+}
+
+/*
+Runs the Deutsch-Jozsa algorithm and Grover's algorithm on several oracles at once in a BatchedRegister, checks that an instance holds the same state
+as a register of its own, and factors 221 by trying several values of a in one batch.
+*/
+void testBatchedRegister(){
+    std::cout << "RUNNING BATCHED REGISTER TEST..." << std::endl;
+
+    std::vector<std::vector<int>> functions = {
+        {0, 0, 0, 0, 0, 0, 0, 0}, {1, 0, 1, 0, 0, 1, 0, 1}, {1, 1, 1, 1, 1, 1, 1, 1}, {0, 1, 1, 0, 1, 0, 0, 1}, {1, 1, 0, 0, 0, 1, 1, 0}
+    };
+    std::vector<Bijection> bitOracles;
+    for(const std::vector<int>& f : functions){
+        bitOracles.push_back(makeBitOracle(f));
+    }
+    std::cout << "Deutsch-Jozsa results:";
+    for(DeutschJozsaResult result : DeutschJozsa(bitOracles)){
+        std::cout << " " << (result == DeutschJozsaResult::BALANCED ? "balanced" : "constant");
+    }
+    std::cout << " (expected: constant balanced constant balanced balanced)" << std::endl;
+
+    std::vector<Rotation> phaseOracles;
+    for(int answer : {123, 7, 200}){
+        std::vector<bool> f(256, false);
+        f[answer] = true;
+        phaseOracles.push_back(makePhaseOracle(f));
+    }
+    std::cout << "Grover results:";
+    for(int answer : Grover(phaseOracles, 1)){
+        std::cout << " " << answer;
+    }
+    std::cout << " (expected: 123 7 200)" << std::endl;
+
+    // Instance 1 of the batch holds the same state as a register that ran the same gates on its own.
+    int n = 4;
+    BatchedRegister batch(n, 3);
+    QuantumRegister single(n);
+    for(int i = 0; i < n; i++){
+        batch.applyUnitary(Gates::H, {i});
+        single.applyUnitary(Gates::H, {i});
+    }
+    Rotation phase(1 << n, [](StateIndex x){
+        return std::polar(1.0, 0.3 * x);
+    });
+    batch.applyRotations({makePhaseOracle(std::vector<bool>(1 << n, true)), phase, phase}, QuantumRegister::inclusiveRange(0, n-1));
+    single.applyRotation(phase, QuantumRegister::inclusiveRange(0, n-1));
+    batch.applyUnitary(Gates::CNOT, {0, 3});
+    single.applyUnitary(Gates::CNOT, {0, 3});
+    double difference = 0;
+    for(StateIndex state = 0; state < (StateIndex(1) << n); state++){
+        difference = std::max(difference, std::abs(batch.getCoefficient(1, state) - single.getCoefficient(state)));
+    }
+    std::cout << "Largest difference between instance 1 and the single register: " << difference << " (expected: 0, up to rounding)" << std::endl;
+
+    // 13 shares a factor with 221, so it is not simulated.
+    std::vector<int> bases = {2, 13, 7, 5};
+    std::vector<std::optional<ShorResult>> results = Shor(221, bases);
+    for(int k = 0; k < (int)bases.size(); k++){
+        std::cout << "a = " << bases[k] << ": ";
+        if(results[k].has_value()){
+            std::cout << "factors " << results[k]->factor1 << " and " << results[k]->factor2 << std::endl;
+        }
+        else{
+            std::cout << "no answer" << std::endl;
+        }
+    }
+    ShorResult factors = ShorBatched(221, 4);
+    std::cout << "Trying 4 values of a at a time, Shor's algorithm calculated the factors of 221 as " << factors.factor1 << " and " << factors.factor2
+        << " (expected: 13 and 17 in some order)" << std::endl;
+
     std::cout << std::endl;
 }
\ No newline at end of file
@@ -6,5 +6,28 @@ void testDeutschJozsa();
 void testGrover();
 void testQFT();
 void testShor();
+void testRepresentations();
+void testAdaptiveRepresentation();
+void testUnitaryStructure();
+void testMultithreading();
+void testKernels();
+void testCircuit();
+void testFusion();
+void testBlockedExecution();
+void testQubitGather();
+void testLargeRegister();
+void testAmplitudeMap();
+void testLargeMeasurement();
+void testSample();
+void testPruning();
+void testFixedUnitary();
+void testMatrixOperations();
+void testControlledGates();
+void testCallableOracles();
+void testModularMultiplication();
+void testStructuredShor();
+void testFFTQFT();
+void testApproximateQFT();
+void testBatchedRegister();
 
 #endif
\ No newline at end of file
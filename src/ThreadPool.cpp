@@ -0,0 +1,120 @@
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <memory>
+
+ThreadPool::ThreadPool(int numThreads){
+    for(int i = 1; i < numThreads; i++){
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for(std::thread& worker : workers){
+        worker.join();
+    }
+}
+
+int ThreadPool::size() const {
+    return workers.size() + 1;
+}
+
+int ThreadPool::runChunks(const std::function<void(long long, long long)>* loopBody, long long n, int chunks){
+    int done = 0;
+    while(true){
+        int chunk = nextChunk.fetch_add(1);
+        if(chunk >= chunks){
+            break;
+        }
+        long long begin = n * chunk / chunks;
+        long long end = n * (chunk + 1) / chunks;
+        (*loopBody)(begin, end);
+        done++;
+    }
+    return done;
+}
+
+void ThreadPool::workerLoop(){
+    long long seenGeneration = 0;
+    while(true){
+        const std::function<void(long long, long long)>* loopBody;
+        long long n;
+        int chunks;
+        {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            workAvailable.wait(lock, [&](){
+                return stopping || generation != seenGeneration;
+            });
+            if(stopping){
+                return;
+            }
+            seenGeneration = generation;
+            loopBody = body;
+            n = loopSize;
+            chunks = numChunks;
+            activeWorkers++;
+        }
+
+        int done = runChunks(loopBody, n, chunks);
+
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            chunksDone += done;
+            activeWorkers--;
+        }
+        workDone.notify_all();
+    }
+}
+
+void ThreadPool::parallelFor(long long n, const std::function<void(long long, long long)>& loopBody, long long minChunkSize){
+    // Use a few chunks per thread so that threads which finish early can help out with the rest.
+    long long chunks = std::min<long long>(4 * size(), n / std::max<long long>(minChunkSize, 1));
+    if(workers.empty() || chunks <= 1){
+        loopBody(0, n);
+        return;
+    }
+
+    std::lock_guard<std::mutex> loopLock(loopMutex);
+    {
+        std::unique_lock<std::mutex> lock(stateMutex);
+
+        // A worker that woke up late for the previous loop may still be looking at its state, so wait for it before replacing that state.
+        workDone.wait(lock, [&](){
+            return activeWorkers == 0;
+        });
+
+        body = &loopBody;
+        loopSize = n;
+        numChunks = chunks;
+        chunksDone = 0;
+        nextChunk = 0;
+        generation++;
+    }
+    workAvailable.notify_all();
+
+    // The calling thread works on the loop too.
+    int done = runChunks(&loopBody, n, chunks);
+
+    std::unique_lock<std::mutex> lock(stateMutex);
+    chunksDone += done;
+    workDone.wait(lock, [&](){
+        return chunksDone == numChunks;
+    });
+}
+
+std::unique_ptr<ThreadPool>& globalPool(){
+    static std::unique_ptr<ThreadPool> pool = std::make_unique<ThreadPool>(std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+}
+
+ThreadPool& ThreadPool::global(){
+    return *globalPool();
+}
+
+void ThreadPool::setGlobalSize(int numThreads){
+    globalPool() = std::make_unique<ThreadPool>(std::max(1, numThreads));
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+
+/*
+A fixed set of worker threads that is created once and reused for every parallel loop.
+Quantum registers use it to split their amplitude array into disjoint blocks that are updated at the same time.
+Since the blocks never overlap, the loop bodies do not need any locking.
+*/
+class ThreadPool{
+    private:
+    std::vector<std::thread> workers;
+
+    // Only one loop runs on the pool at a time.
+    std::mutex loopMutex;
+
+    // Protects the state of the current loop below.
+    std::mutex stateMutex;
+    std::condition_variable workAvailable;
+    std::condition_variable workDone;
+
+    const std::function<void(long long, long long)>* body = nullptr;
+    long long loopSize = 0;
+    int numChunks = 0;
+    std::atomic<int> nextChunk{0};
+    int chunksDone = 0;
+    int activeWorkers = 0;
+    long long generation = 0;
+    bool stopping = false;
+
+    void workerLoop();
+
+    // Runs chunks of a loop until there are none left. Returns the number of chunks that were run.
+    int runChunks(const std::function<void(long long, long long)>* loopBody, long long n, int chunks);
+
+    public:
+    // Creates a pool that runs loops on numThreads threads in total (the calling thread plus numThreads - 1 workers).
+    ThreadPool(int numThreads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const;
+
+    /*
+    Splits the range [0, n) into contiguous chunks and calls body(begin, end) once for each chunk, using every thread in the pool.
+    Blocks until all chunks are done. If n is smaller than 2 * minChunkSize, the loop simply runs on the calling thread.
+    body must not call parallelFor on the same pool.
+    */
+    void parallelFor(long long n, const std::function<void(long long, long long)>& body, long long minChunkSize = 1 << 12);
+
+    /*
+    The process-wide pool that registers use unless they are given their own.
+    It starts out with one thread per core, which can be changed with setGlobalSize (this must not be called while the pool is in use).
+    */
+    static ThreadPool& global();
+    static void setGlobalSize(int numThreads);
+};
+
+#endif
\ No newline at end of file
@@ -1,106 +1,195 @@
 #include "Unitary.hpp"
 #include "Math.hpp"
+#include "Kernels.hpp"
 #include <cassert>
+#include <algorithm>
 
-Unitary::Unitary(Matrix _matrix): matrix(_matrix) {}
+Unitary::Unitary(const Matrix& matrix): n(matrix.size()), entries((size_t)n * n) {
+    for(int i = 0; i < n; i++){
+        assert((int)matrix[i].size() == n);
+        std::copy(matrix[i].begin(), matrix[i].end(), entries.begin() + (size_t)i * n);
+    }
+    classify();
+}
+
+Unitary::Unitary(int size, AmplitudeVector _entries): n(size), entries(std::move(_entries)) {
+    assert(entries.size() == (size_t)n * n);
+    classify();
+}
+
+void Unitary::classify(){
+    permutation.assign(n, -1);
+    phases.assign(n, 0);
 
-const Vector& Unitary::operator[](int i) const {
-    return matrix[i];
+    bool diagonal = true;
+    for(int j = 0; j < n; j++){
+        for(int i = 0; i < n; i++){
+            if((*this)[i][j] == 0.0){
+                continue;
+            }
+            if(permutation[j] != -1){
+                // This column has more than one non-zero entry.
+                structure = GENERAL;
+                return;
+            }
+            permutation[j] = i;
+            phases[j] = (*this)[i][j];
+            if(i != j){
+                diagonal = false;
+            }
+        }
+    }
+    structure = diagonal ? DIAGONAL : PERMUTATION;
 }
 
 int Unitary::size() const {
-    return matrix.size();
+    return n;
 }
 
-// Constructs a square matrix of all zeros of a given size
-Matrix zero(int size){
-    return Matrix(size, Vector(size, 0));
+UnitaryStructure Unitary::getStructure() const {
+    return structure;
 }
 
+const std::vector<int>& Unitary::getPermutation() const {
+    return permutation;
+}
+
+const Vector& Unitary::getPhases() const {
+    return phases;
+}
+
+/*
+The matrix product works on tiles of GEMM_TILE x GEMM_TILE entries of u (64 KiB), so that the rows of u being added up stay in cache
+while every row of the product goes past them. For matrices up to 6 qubits this is the whole matrix.
+*/
+const int GEMM_TILE = 64;
+
 Unitary Unitary::operator*(const Unitary& u) const {
     assert(this->size() == u.size());
 
-    int n = this->size();
-    Unitary v = zero(n);
-    for(int i = 0; i < n; i++){
-        for(int j = 0; j < n; j++){
-            for(int k = 0; k < n; k++){
-                v.matrix[i][j] += this->matrix[i][k] * u.matrix[k][j];
+    /*
+    Row i of the product is the sum of the rows k of u, each multiplied by entry (i, k) of this matrix. Adding up whole rows keeps the inner loop
+    on contiguous memory (so it can use the vectorized addScaledKernel), and skips the rows whose entry is 0, which is most of them for permutations
+    and other structured gates. Each entry still adds up its terms in order of k, like the textbook triple loop.
+    */
+    AmplitudeVector product((size_t)n * n, 0);
+    for(int kStart = 0; kStart < n; kStart += GEMM_TILE){
+        int kEnd = std::min(n, kStart + GEMM_TILE);
+        for(int jStart = 0; jStart < n; jStart += GEMM_TILE){
+            int jEnd = std::min(n, jStart + GEMM_TILE);
+            for(int i = 0; i < n; i++){
+                std::complex<double>* row = &product[(size_t)i * n];
+                for(int k = kStart; k < kEnd; k++){
+                    std::complex<double> x = entries[(size_t)i * n + k];
+                    if(x != 0.0){
+                        addScaledKernel(row + jStart, u[k] + jStart, jEnd - jStart, x);
+                    }
+                }
             }
         }
     }
-    return v;
+    return Unitary(n, std::move(product));
 }
 
-Unitary Unitary::operator*(const std::complex<double>& z) const {
-    int n = size();
-    Unitary v = zero(n);
-    for(int i = 0; i < n; i++){
-        for(int j = 0; j < n; j++){
-            v.matrix[i][j] = this->matrix[i][j] * z;
-        }
+Unitary Unitary::operator*(const std::complex<double>& z) const & {
+    return Unitary(*this) * z;
+}
+
+Unitary Unitary::operator*(const std::complex<double>& z) && {
+    for(std::complex<double>& entry : entries){
+        entry = multiplyComplex(entry, z);
     }
-    return v;
+    classify();
+    return std::move(*this);
 }
 
 Unitary operator*(const std::complex<double>& z, const Unitary& u){
     return u * z;
 }
 
-Unitary Unitary::operator-() const {
-    return -1 * (*this);
+Unitary operator*(const std::complex<double>& z, Unitary&& u){
+    return std::move(u) * z;
+}
+
+Unitary Unitary::operator-() const & {
+    return -Unitary(*this);
+}
+
+Unitary Unitary::operator-() && {
+    return std::move(*this) * -1.0;
 }
 
 Unitary Unitary::tensor(const Unitary& u) const{
-    int n = this->size();
+    // The Kronecker product: row (i, k) is row i of this matrix, with each entry replaced by that entry times row k of u.
     int m = u.size();
-    Unitary v = zero(n * m);
+    int size = n * m;
+    AmplitudeVector v((size_t)size * size);
     for(int i = 0; i < n; i++){
-        for(int j = 0; j < n; j++){
-            for(int k = 0; k < m; k++){
+        for(int k = 0; k < m; k++){
+            std::complex<double>* row = &v[(size_t)(i*m + k) * size];
+            const std::complex<double>* other = u[k];
+            for(int j = 0; j < n; j++){
+                std::complex<double> x = entries[(size_t)i * n + j];
                 for(int l = 0; l < m; l++){
-                    v.matrix[i*m + k][j*m + l] = this->matrix[i][j] * u.matrix[k][l];
+                    row[j*m + l] = multiplyComplex(x, other[l]);
                 }
             }
         }
     }
-    return v;
+    return Unitary(size, std::move(v));
 }
 
-Unitary Unitary::conjugate() const{
-    int n = size();
-    Unitary v = zero(n);
+Unitary Unitary::conjugate() const & {
+    return Unitary(*this).conjugate();
+}
+
+Unitary Unitary::conjugate() && {
+    for(std::complex<double>& entry : entries){
+        entry = std::conj(entry);
+    }
+    classify();
+    return std::move(*this);
+}
+
+Unitary Unitary::transpose() const & {
+    return Unitary(*this).transpose();
+}
+
+Unitary Unitary::transpose() && {
     for(int i = 0; i < n; i++){
-        for(int j = 0; j < n; j++){
-            v.matrix[i][j] = std::conj(matrix[i][j]);
+        for(int j = i + 1; j < n; j++){
+            std::swap(entries[(size_t)i * n + j], entries[(size_t)j * n + i]);
         }
     }
-    return v;
+    classify();
+    return std::move(*this);
 }
 
-Unitary Unitary::transpose() const{
-    int n = size();
-    Unitary v = zero(n);
+Unitary Unitary::adjoint() const & {
+    return Unitary(*this).adjoint();
+}
+
+Unitary Unitary::adjoint() && {
     for(int i = 0; i < n; i++){
-        for(int j = 0; j < n; j++){
-            v.matrix[i][j] = matrix[j][i];
+        entries[(size_t)i * n + i] = std::conj(entries[(size_t)i * n + i]);
+        for(int j = i + 1; j < n; j++){
+            std::complex<double> upper = entries[(size_t)i * n + j];
+            entries[(size_t)i * n + j] = std::conj(entries[(size_t)j * n + i]);
+            entries[(size_t)j * n + i] = std::conj(upper);
         }
     }
-    return v;
+    classify();
+    return std::move(*this);
 }
 
 Unitary Unitary::controlled() const {
-    int n = size();
-    Unitary u = zero(2 * n);
+    int size = 2 * n;
+    AmplitudeVector v((size_t)size * size, 0);
     for(int i = 0; i < n; i++){
-        u.matrix[i][i] = 1;
-    }
-    for(int i = n; i < 2*n; i++){
-        for(int j = n; j < 2*n; j++){
-            u.matrix[i][j] = this->matrix[i-n][j-n];
-        }
+        v[(size_t)i * size + i] = 1;
+        std::copy(entries.begin() + (size_t)i * n, entries.begin() + (size_t)(i + 1) * n, v.begin() + (size_t)(i + n) * size + n);
     }
-    return u;
+    return Unitary(size, std::move(v));
 }
 
 std::ostream& operator<<(std::ostream& os, const Unitary& u){
@@ -108,7 +197,7 @@ std::ostream& operator<<(std::ostream& os, const Unitary& u){
     for(int i = 0; i < n; i++){
         os << "[ ";
         for(int j = 0; j < n; j++){
-            os << u.matrix[i][j] << " ";
+            os << u[i][j] << " ";
         }
         os << "]\n";
     }
@@ -116,11 +205,11 @@ std::ostream& operator<<(std::ostream& os, const Unitary& u){
 }
 
 Unitary Unitary::identity(int size){
-    Unitary I = zero(size);
+    AmplitudeVector I((size_t)size * size, 0);
     for(int i = 0; i < size; i++){
-        I.matrix[i][i] = 1;
+        I[(size_t)i * size + i] = 1;
     }
-    return I;
+    return Unitary(size, std::move(I));
 }
 
 Unitary Unitary::X(){
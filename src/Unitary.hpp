@@ -1,6 +1,7 @@
 #ifndef UNITARY_HPP
 #define UNITARY_HPP
 
+#include "AlignedAllocator.hpp"
 #include <complex>
 #include <vector>
 #include <iostream>
@@ -9,23 +10,79 @@
 using Vector = std::vector<std::complex<double>>;
 using Matrix = std::vector<Vector>;
 
+/*
+The structure of a unitary matrix, which is detected once when the matrix is constructed.
+    * DIAGONAL: only the diagonal entries are non-zero, so the unitary just multiplies each state by a phase (e.g. Z, phase gates and their controlled versions).
+    * PERMUTATION: each column has exactly one non-zero entry, so the unitary sends each state to a single other state, possibly with a phase (e.g. X, CNOT, SWAP).
+    * GENERAL: anything else (e.g. H).
+Every diagonal matrix is also a permutation, but we report the more specific structure.
+*/
+enum UnitaryStructure {
+    DIAGONAL, PERMUTATION, GENERAL
+};
+
+/*
+A square unitary matrix of any size. The entries are stored row by row in one cache line aligned buffer, so a row is contiguous in memory
+and the whole matrix can be handed to the dense kernels as it is (see data).
+*/
 class Unitary {
     private:
-    Matrix matrix;
+    int n;
+    AmplitudeVector entries;
+
+    UnitaryStructure structure;
+
+    // If the structure is DIAGONAL or PERMUTATION, column j only has a non-zero entry in row permutation[j], which is equal to phases[j].
+    std::vector<int> permutation;
+    Vector phases;
+
+    void classify();
 
     public:
-    Unitary(Matrix _matrix);
-    const Vector& operator[](int i) const;
+    Unitary(const Matrix& matrix);
+
+    // Takes over a buffer of size * size entries, stored row by row.
+    Unitary(int size, AmplitudeVector _entries);
+
+    // Returns row i, so that u[i][j] is the entry in row i and column j.
+    const std::complex<double>* operator[](int i) const {
+        return &entries[(size_t)i * n];
+    }
+
+    // All of the entries, stored row by row.
+    const std::complex<double>* data() const {
+        return entries.data();
+    }
+
     int size() const;
 
+    UnitaryStructure getStructure() const;
+    const std::vector<int>& getPermutation() const;
+    const Vector& getPhases() const;
+
     Unitary operator*(const Unitary& u) const;
-    Unitary operator*(const std::complex<double>& z) const;
+
+    /*
+    The operations below that keep the size of the matrix have a second version for temporaries (e.g. u.transpose().conjugate() or -(u * z)),
+    which reuses the buffer of the temporary instead of allocating a new one.
+    */
+    Unitary operator*(const std::complex<double>& z) const &;
+    Unitary operator*(const std::complex<double>& z) &&;
     friend Unitary operator*(const std::complex<double>& z, const Unitary& u);
-    Unitary operator-() const;
-    
+    friend Unitary operator*(const std::complex<double>& z, Unitary&& u);
+    Unitary operator-() const &;
+    Unitary operator-() &&;
+
     Unitary tensor(const Unitary& u) const;
-    Unitary conjugate() const;
-    Unitary transpose() const;
+    Unitary conjugate() const &;
+    Unitary conjugate() &&;
+    Unitary transpose() const &;
+    Unitary transpose() &&;
+
+    // The conjugate transpose (the inverse of a unitary), computed in a single pass.
+    Unitary adjoint() const &;
+    Unitary adjoint() &&;
+
     Unitary controlled() const;
 
     friend std::ostream& operator<<(std::ostream& os, const Unitary& u);